@@ -45,7 +45,9 @@ in vec2 fUV;
 
 
 // speed of ROTATION
+#ifndef ROTATION_SPEED
 #define ROTATION_SPEED 0.8999
+#endif
 
 
 // static SHAPE form, default 0.5
@@ -53,7 +55,9 @@ in vec2 fUV;
 
 
 // static SCALE far/close to camera, 2.0 is default, exampe 0.5 or 10.0
+#ifndef CAMERA_FAR
 #define CAMERA_FAR 4.0
+#endif
 
 
 // ANIMATION shape change
@@ -0,0 +1,13 @@
+#version 330 core
+out vec3 fragColor;
+in vec2 fUV;
+uniform sampler2D iChannel0;
+uniform sampler2D iChannel1;
+
+void main()
+{
+    vec3 trail = texture(iChannel0, fUV).rgb;
+    vec3 background = texture(iChannel1, fUV).rgb * 0.3;
+    vec3 color = background + trail;
+    fragColor = color / (1.0 + color);
+}
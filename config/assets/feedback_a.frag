@@ -0,0 +1,22 @@
+#version 330 core
+out vec4 fragColor;
+in vec2 fUV;
+uniform vec3 iResolution;
+uniform float iTime;
+uniform float iTimeDelta;
+uniform int iFrame;
+uniform sampler2D iChannel0;
+
+void main()
+{
+    // Previous frame of this buffer, slowly advected and faded
+    vec2 uv = fUV;
+    vec2 flow = vec2(sin(uv.y * 6.0 + iTime), cos(uv.x * 6.0 - iTime)) * 0.002;
+    vec3 history = iFrame == 0 ? vec3(0.0) : texture(iChannel0, uv + flow).rgb * exp(-iTimeDelta * 0.8);
+
+    vec2 p = vec2(0.5) + vec2(cos(iTime * 0.7), sin(iTime * 1.1)) * 0.3;
+    vec2 d = (uv - p) * vec2(iResolution.x / iResolution.y, 1.0);
+    vec3 emitter = vec3(0.5 + 0.5 * sin(iTime), 0.4, 0.8) * exp(-dot(d, d) * 800.0) * 4.0;
+
+    fragColor = vec4(history + emitter, 1.0);
+}
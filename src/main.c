@@ -6,12 +6,29 @@
 #include <stdlib.h>
 #include <string.h>
 #include <sys/time.h>
+#include <time.h>
+#include <errno.h>
+#include <poll.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <math.h>
+#include <sys/timerfd.h>
+#include <signal.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <fcntl.h>
+#include <zlib.h>
+#include <pthread.h>
+#include <sys/inotify.h>
+#include <sys/eventfd.h>
+#include <dirent.h>
 #include <X11/keysym.h>
 #include "stb_image.h"
 #include "glad.h"
 #include <GL/gl.h>
 #include <GL/glx.h>
 #include "parser.h"
+#include "resample.h"
 #define GLT_IMPLEMENTATION
 #include "glText.h"
 #define NK_PRIVATE
@@ -32,9 +49,51 @@
 #define MAX_LOG_SIZE            512 * 8
 #define MAX_TEXTURE_SLOTS       32
 #define MAX_HINT_UNIFORMS       128
+#define MAX_CHANNELS            4
+#define TEXTURE_ARRAY_UNIT      (MAX_TEXTURE_SLOTS + MAX_CHANNELS) // After the user textures and channels, no sampler2D defaults to it
+#define MAX_DECODE_THREADS      8
+#define MAX_TEXTURE_LEVELS      16
+#define TEXTURE_CACHE_MB        512
+#define MAX_RENDER_TARGETS      8
+#define MAX_POOLED_TARGETS      32
+#define POOL_EVICT_FRAMES       120
+#define POOL_BUDGET_MB          256
+#define RENDER_PASS_COUNT       5
+#define RENDER_PASS_IMAGE       4
 #define MAX_UNIFORM_NAME_LENGTH 256
+#define DEFAULT_TARGET_FPS      60
+#define PACER_REPORT_INTERVAL   10
+#define PROFILER_FRAMES         4
+#define PROFILER_SAMPLES        256
+#define DEFAULT_SLICE_BUDGET    4.0f
+#define DEFAULT_LOOP_FPS        30
+#define DEFAULT_LOOP_BUDGET     512
+#define LOOP_CACHE_MB           2048
+#define CACHE_STALE_TIME        3600
+#define LOOP_MAX_FRAMES         3600
+#define LOOP_RING_SIZE          4
+#define HASH_SEED               1469598103934665603ULL
+#define GOVERNOR_LOG_SIZE       64
+#define GOVERNOR_SETTLE_FRAMES  8
+#define GOVERNOR_PATIENCE       10
+#define GOVERNOR_HEADROOM       0.6f
+#define GOVERNOR_SCALE_STEP     0.05f
+#define MAX_WATCHED_FILES       32
+#define MAX_QUALITY_TIERS       8
+#define FREEZE_IDLE_TIME        2000000000LL
+#define MAX_DEFINES_LENGTH      4096
+#define MAX_INCLUDE_DEPTH       16
+#define MAX_SHADER_DEPENDENCIES 16
+#define PREPROCESS_CACHE_SIZE   16
+#define BENCH_DEFAULT_FRAMES    300
+#define BENCH_DEFAULT_WIDTH     1920
+#define BENCH_DEFAULT_HEIGHT    1080
+#define BENCH_WARMUP_FRAMES     10
+#define BENCH_TIMESTEP          (1.0f / 60.0f)
 
 typedef GLXContext (*glXCreateContextAttribsARBProc)(Display*, GLXFBConfig, GLXContext, Bool, const int*);
+typedef void (*glXSwapIntervalEXTProc)(Display*, GLXDrawable, int);
+typedef int (*glXSwapIntervalMESAProc)(unsigned int);
 
 int exists(const char* fname) {
   FILE* file;
@@ -114,6 +173,10 @@ char* findfile(const char* file) {
 
 void* fileRead(const char* abpath) {
   char* path = findfile(abpath);
+  if (!path) {
+    fprintf(stderr, "File not found: %s\n", abpath);
+    return 0;
+  }
 
   FILE* file = fopen(path, "rb");
   if (!file) {
@@ -145,21 +208,371 @@ void* fileRead(const char* abpath) {
   return source;
 }
 
-char infolog[MAX_LOG_SIZE];
+long long monotonicNow() {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return (long long)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
 
-GLuint glShaderCompile(const char* path, GLenum type) {
-  void* source = fileRead(path);
+//FNV-1a, used to key on-disk caches
+uint64_t hashBytes(uint64_t hash, const void* data, size_t size) {
+  const unsigned char* bytes = data;
+  for (size_t i = 0; i < size; i++) {
+    hash ^= bytes[i];
+    hash *= 1099511628211ULL;
+  }
+  return hash;
+}
+
+uint64_t hashString(uint64_t hash, const char* str) {
+  return str ? hashBytes(hash, str, strlen(str) + 1) : hash;
+}
+
+//Resolves and creates $XDG_CACHE_HOME/shaderpaper/<sub> (~/.cache/shaderpaper/<sub> by default)
+int cacheDirectory(char* dst, size_t size, const char* sub) {
+  const char* xdg  = getenv("XDG_CACHE_HOME");
+  const char* home = getenv("HOME");
+  if (xdg && xdg[0]) snprintf(dst, size, "%s/shaderpaper", xdg);
+  else if (home)
+    snprintf(dst, size, "%s/.cache/shaderpaper", home);
+  else
+    return 1;
+
+  char parent[MAX_LINE_LENGTH];
+  snprintf(parent, sizeof(parent), "%s", dst);
+  *strrchr(parent, '/') = 0;
+  mkdir(parent, 0755);
+  mkdir(dst, 0755);
+
+  size_t len = strlen(dst);
+  snprintf(dst + len, size - len, "/%s", sub);
+  if (mkdir(dst, 0755) && errno != EEXIST) {
+    perror("[ERR] Cannot create cache directory");
+    return 1;
+  }
+  return 0;
+}
+
+struct CacheEntry {
+  char   name[32];
+  time_t used;
+  off_t  size;
+};
+
+int cacheEntryCompare(const void* a, const void* b) {
+  time_t ua = ((const struct CacheEntry*)a)->used;
+  time_t ub = ((const struct CacheEntry*)b)->used;
+  return ua < ub ? -1 : ua > ub;
+}
+
+//Unlinks the least recently used <sub>/*<extension> files until they fit in limit bytes, the newest one is always kept.
+//Temporary files not written for CACHE_STALE_TIME seconds are left over from a crash and removed as well.
+//Returns how many were removed
+int cacheDirectoryTrim(const char* sub, const char* extension, long long limit) {
+  char directory[MAX_LINE_LENGTH];
+  if (cacheDirectory(directory, sizeof(directory), sub)) return 0;
+
+  DIR* dir = opendir(directory);
+  if (!dir) return 0;
+
+  struct CacheEntry* entries   = NULL;
+  int                count     = 0;
+  int                capacity  = 0;
+  long long          total     = 0;
+  int                evicted   = 0;
+  size_t             extLength = strlen(extension);
+  time_t             now       = time(NULL);
+  struct dirent*     entry;
+  while ((entry = readdir(dir))) {
+    char        path[MAX_LINE_LENGTH * 2];
+    struct stat info;
+    size_t      length    = strlen(entry->d_name);
+    int         temporary = length > 4 && strcmp(entry->d_name + length - 4, ".tmp") == 0;
+    if (!temporary && (length < extLength || length >= sizeof(entries->name) || strcmp(entry->d_name + length - extLength, extension)))
+      continue;
+    snprintf(path, sizeof(path), "%s/%s", directory, entry->d_name);
+    if (stat(path, &info)) continue;
+    if (temporary) {
+      if (now - info.st_mtime > CACHE_STALE_TIME && unlink(path) == 0) evicted++;
+      continue;
+    }
+
+    if (count == capacity) {
+      capacity = capacity ? capacity * 2 : 64;
+      entries  = realloc(entries, capacity * sizeof(struct CacheEntry));
+    }
+    strcpy(entries[count].name, entry->d_name);
+    entries[count].used = info.st_mtime;
+    entries[count].size = info.st_size;
+    total += info.st_size;
+    count++;
+  }
+  closedir(dir);
+
+  qsort(entries, count, sizeof(struct CacheEntry), cacheEntryCompare);
+  for (int i = 0; i < count - 1 && total > limit; i++) {
+    char path[MAX_LINE_LENGTH * 2];
+    snprintf(path, sizeof(path), "%s/%s", directory, entries[i].name);
+    if (unlink(path) == 0) {
+      total -= entries[i].size;
+      evicted++;
+    }
+  }
+  free(entries);
+  return evicted;
+}
+
+_Thread_local char infolog[MAX_LOG_SIZE]; // Shaders are also compiled on the hot reload worker
+
+//=========================[GLSL PREPROCESSOR]===================================================
+
+// Shader sources are expanded before compiling: #include "file" is resolved next to the including file and then
+// through the findfile search paths, and the #define block from the configuration is injected after #version.
+// A file containing #pragma once is expanded once per program, later includes of it are dropped; other files are
+// expanded every time they are included. Expansions are cached in memory together with a hash of the contents of
+// every file they read, so a cached result is reused as long as none of its files changed.
+struct ShaderSourceBuffer {
+  char*  data;
+  size_t size;
+  size_t capacity;
+};
+
+struct PreprocessEntry {
+  uint64_t  key;   // Root path and defines
+  uint64_t  stamp; // Hash of the contents of every dependency, in include order
+  int       dependencyCount;
+  char      dependencies[MAX_SHADER_DEPENDENCIES][MAX_LINE_LENGTH]; // Each file once, the index is its #line source number
+  char      once[MAX_SHADER_DEPENDENCIES]; // The file has #pragma once
+  char*     output;
+  long long lastUse;
+};
+
+struct PreprocessCache {
+  struct PreprocessEntry entries[PREPROCESS_CACHE_SIZE];
+  int                    hits;
+  int                    misses;
+  pthread_mutex_t        lock; // Also used from the hot reload worker
+} preprocessCache = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+void shaderSourceAppend(struct ShaderSourceBuffer* buffer, const char* str, size_t len) {
+  if (buffer->size + len + 1 > buffer->capacity) {
+    buffer->capacity = (buffer->size + len + 1) * 2;
+    buffer->data     = realloc(buffer->data, buffer->capacity);
+  }
+  memcpy(buffer->data + buffer->size, str, len);
+  buffer->size += len;
+  buffer->data[buffer->size] = 0;
+}
+
+void shaderSourceAppendLine(struct ShaderSourceBuffer* buffer, int line, int source) {
+  char directive[64];
+  shaderSourceAppend(buffer, directive, snprintf(directive, sizeof(directive), "#line %d %d\n", line, source));
+}
+
+//Folds the contents of path into stamp, returns 0 if the file is gone
+uint64_t glslFileStamp(uint64_t stamp, const char* path) {
+  char* source = fileRead(path);
+  if (!source) return 0;
+  stamp = hashString(stamp, source);
+  free(source);
+  return stamp;
+}
+
+//Index of path in the dependencies of entry, -1 if it was not read yet
+int glslDependencyIndex(struct PreprocessEntry* entry, const char* path) {
+  for (int i = 0; i < entry->dependencyCount; i++)
+    if (strcmp(entry->dependencies[i], path) == 0) return i;
+  return -1;
+}
+
+//Resolves an include against the directory of the including file first, then the search paths
+char* glslResolveInclude(const char* parent, const char* file) {
+  char        candidate[MAX_LINE_LENGTH];
+  const char* slash = strrchr(parent, '/');
+  if (file[0] != '/' && slash) {
+    snprintf(candidate, sizeof(candidate), "%.*s/%s", (int)(slash - parent), parent, file);
+    if (exists(candidate)) return strdup(candidate);
+  }
+  return findfile(file);
+}
+
+int glslExpand(struct ShaderSourceBuffer* out, const char* path, const char* defines, int depth, struct PreprocessEntry* entry) {
+  if (depth > MAX_INCLUDE_DEPTH) {
+    snprintf(infolog, MAX_LOG_SIZE, "Include depth exceeded at %s (recursive include?)", path);
+    return 1;
+  }
+  int sourceIndex = glslDependencyIndex(entry, path);
+  if (sourceIndex == -1 && entry->dependencyCount == MAX_SHADER_DEPENDENCIES) {
+    snprintf(infolog, MAX_LOG_SIZE, "Too many includes, %s not expanded", path);
+    return 1;
+  }
+
+  char* source = fileRead(path);
+  if (!source) {
+    snprintf(infolog, MAX_LOG_SIZE, "Shader file not found: %s", path);
+    return 1;
+  }
+
+  if (sourceIndex == -1) { // A file included again keeps its source number and is stamped once
+    sourceIndex = entry->dependencyCount++;
+    snprintf(entry->dependencies[sourceIndex], MAX_LINE_LENGTH, "%s", path);
+    entry->stamp = hashString(entry->stamp, source);
+  }
+  if (depth > 0) shaderSourceAppendLine(out, 1, sourceIndex);
+
+  int injected = depth > 0 || !defines[0];
+  if (!injected && !strstr(source, "#version")) {
+    shaderSourceAppend(out, defines, strlen(defines));
+    shaderSourceAppendLine(out, 1, sourceIndex);
+    injected = 1;
+  }
+
+  int   failed = 0;
+  int   line   = 1;
+  char* cursor = source;
+  while (*cursor && !failed) {
+    char*  end    = strchr(cursor, '\n');
+    size_t length = end ? (size_t)(end - cursor + 1) : strlen(cursor);
+    char*  token  = cursor + strspn(cursor, " \t");
+
+    if (strncmp(token, "#include", 8) == 0) {
+      char* open  = strpbrk(token + 8, "\"<");
+      char* close = open ? strpbrk(open + 1, "\">\n") : NULL;
+      if (!close || *close == '\n') {
+        snprintf(infolog, MAX_LOG_SIZE, "%s:%d: malformed #include", path, line);
+        failed = 1;
+        break;
+      }
+
+      char name[MAX_LINE_LENGTH];
+      snprintf(name, sizeof(name), "%.*s", (int)(close - open - 1), open + 1);
+      char* included = glslResolveInclude(path, name);
+      if (!included) {
+        snprintf(infolog, MAX_LOG_SIZE, "%s:%d: cannot find include %s", path, line, name);
+        failed = 1;
+        break;
+      }
+
+      int index = glslDependencyIndex(entry, included);
+      if (index == -1 || !entry->once[index]) {
+        failed = glslExpand(out, included, defines, depth + 1, entry);
+        shaderSourceAppend(out, "\n", 1);
+        shaderSourceAppendLine(out, line + 1, sourceIndex);
+      } else shaderSourceAppend(out, "\n", 1); // Keeps the line numbers of the rest of the file
+      free(included);
+    } else if (strncmp(token, "#pragma", 7) == 0 && strncmp(token + 7 + strspn(token + 7, " \t"), "once", 4) == 0) {
+      entry->once[sourceIndex] = 1;
+      shaderSourceAppend(out, "\n", 1);
+    } else {
+      shaderSourceAppend(out, cursor, length);
+      if (!injected && strncmp(token, "#version", 8) == 0) {
+        if (!end) shaderSourceAppend(out, "\n", 1);
+        shaderSourceAppend(out, defines, strlen(defines));
+        shaderSourceAppendLine(out, line + 1, sourceIndex);
+        injected = 1;
+      }
+    }
+
+    cursor += length;
+    line++;
+  }
+
+  free(source);
+  return failed;
+}
+
+//Stamp of the files a cached expansion was built from, 0 if one of them is gone
+uint64_t glslDependencyStamp(struct PreprocessEntry* entry) {
+  uint64_t stamp = 0;
+  for (int i = 0; i < entry->dependencyCount; i++)
+    if (!(stamp = glslFileStamp(stamp, entry->dependencies[i]))) return 0;
+  return stamp;
+}
+
+//Returns the expanded source of path (to be freed by the caller), or 0 with the error in infolog
+char* glslPreprocess(const char* path, const char* defines) {
+  char* resolved = findfile(path);
+  if (!resolved) {
+    snprintf(infolog, MAX_LOG_SIZE, "Shader file not found: %s", path);
+    return 0;
+  }
+
+  uint64_t key = hashString(hashString(HASH_SEED, resolved), defines);
+  char*    output = NULL;
+
+  pthread_mutex_lock(&preprocessCache.lock);
+  struct PreprocessEntry* slot = &preprocessCache.entries[0];
+  for (int i = 0; i < PREPROCESS_CACHE_SIZE; i++) {
+    struct PreprocessEntry* entry = &preprocessCache.entries[i];
+    if (entry->output && entry->key == key) {
+      slot = entry;
+      if (glslDependencyStamp(entry) == entry->stamp) output = strdup(entry->output);
+      break;
+    }
+    if (entry->lastUse < slot->lastUse) slot = entry;
+  }
+
+  if (output) {
+    preprocessCache.hits++;
+  } else {
+    struct PreprocessEntry    entry  = {0};
+    struct ShaderSourceBuffer buffer = {0};
+    entry.key                        = key;
+    preprocessCache.misses++;
+    if (!glslExpand(&buffer, resolved, defines, 0, &entry)) {
+      free(slot->output);
+      *slot        = entry;
+      slot->output = buffer.data;
+      output       = strdup(buffer.data);
+    } else {
+      free(buffer.data);
+      fprintf(stderr, "[ERR] Preprocessing %s: %s\n", path, infolog);
+    }
+  }
+  slot->lastUse = monotonicNow();
+  pthread_mutex_unlock(&preprocessCache.lock);
+
+  free(resolved);
+  return output;
+}
+
+//Copies the files the last expansion of path read into dependencies, returns how many
+int glslDependencies(const char* path, const char* defines, char dependencies[][MAX_LINE_LENGTH], int maxDependencies) {
+  char* resolved = findfile(path);
+  if (!resolved) return 0;
+  uint64_t key   = hashString(hashString(HASH_SEED, resolved), defines);
+  int      count = 0;
+  free(resolved);
+
+  pthread_mutex_lock(&preprocessCache.lock);
+  for (int i = 0; i < PREPROCESS_CACHE_SIZE; i++) {
+    struct PreprocessEntry* entry = &preprocessCache.entries[i];
+    if (!entry->output || entry->key != key) continue;
+    for (; count < entry->dependencyCount && count < maxDependencies; count++)
+      memcpy(dependencies[count], entry->dependencies[count], MAX_LINE_LENGTH);
+    break;
+  }
+  pthread_mutex_unlock(&preprocessCache.lock);
+  return count;
+}
 
+//=========================[SHADER PROGRAMS]===================================================
+
+//Queues the compile without querying its status, which would wait for the driver to finish it
+GLuint glShaderCompileStart(const char* source, GLenum type) {
   GLuint shader = glCreateShader(type);
-  glShaderSource(shader, 1, (const char**)&source, NULL);
+  glShaderSource(shader, 1, &source, NULL);
   glCompileShader(shader);
-  free(source);
+  return shader;
+}
 
+//Returns shader if it compiled successfully, otherwise deletes it and leaves the log in infolog
+GLuint glShaderCheck(GLuint shader, const char* name) {
   GLint status;
   glGetShaderiv(shader, GL_COMPILE_STATUS, &status);
   if (status != GL_TRUE) {
     glGetShaderInfoLog(shader, sizeof(infolog), NULL, infolog);
-    fprintf(stderr, "Shader compile error (%s):\n%s\n", path, infolog);
+    fprintf(stderr, "Shader compile error (%s):\n%s\n", name, infolog);
     glDeleteShader(shader);
     return 0;
   }
@@ -167,33 +580,335 @@ GLuint glShaderCompile(const char* path, GLenum type) {
   return shader;
 }
 
-//Compiles shader program from shader files
-GLuint glProgramCompile(const char* fs, const char* vs) {
-  GLuint fragShader = glShaderCompile(fs, GL_FRAGMENT_SHADER);
-  GLuint vertShader = glShaderCompile(vs, GL_VERTEX_SHADER);
-  if (!fragShader || !vertShader) return 0;
+GLuint glShaderCompileSource(const char* source, const char* name, GLenum type) {
+  return glShaderCheck(glShaderCompileStart(source, type), name);
+}
+
+GLuint glShaderCompile(const char* path, GLenum type) {
+  void* source = fileRead(path);
+  if (!source) return 0;
+
+  GLuint shader = glShaderCompileSource(source, path, type);
+  free(source);
+  return shader;
+}
+
+int glProgramCacheSupported();
 
+//Queues the link of two compiled shaders, which are released afterwards
+GLuint glProgramLinkStart(GLuint fragShader, GLuint vertShader) {
   GLuint program = glCreateProgram();
+  if (glProgramCacheSupported()) glProgramParameteri(program, GL_PROGRAM_BINARY_RETRIEVABLE_HINT, GL_TRUE);
   glAttachShader(program, vertShader);
   glAttachShader(program, fragShader);
   glLinkProgram(program);
 
   glDeleteShader(fragShader);
   glDeleteShader(vertShader);
+  return program;
+}
+
+//Returns program if it linked successfully, otherwise deletes it and leaves the log in infolog
+GLuint glProgramCheck(GLuint program) {
+  GLint status;
+  glGetProgramiv(program, GL_LINK_STATUS, &status);
+  if (status != GL_TRUE) {
+    glGetProgramInfoLog(program, sizeof(infolog), NULL, infolog);
+    fprintf(stderr, "Program link error:\n%s\n", infolog);
+    glDeleteProgram(program);
+    return 0;
+  }
+
+  return program;
+}
+
+GLuint glProgramLink(GLuint fragShader, GLuint vertShader) {
+  if (!fragShader || !vertShader) {
+    if (fragShader) glDeleteShader(fragShader);
+    if (vertShader) glDeleteShader(vertShader);
+    return 0;
+  }
+  return glProgramCheck(glProgramLinkStart(fragShader, vertShader));
+}
+
+//Linked programs are cached on disk with glGetProgramBinary, keyed by their sources and the driver identification
+struct ProgramCacheHeader {
+  char     magic[8];
+  uint64_t key;
+  uint32_t format;
+  uint32_t length;
+  int64_t  compileTime; // ns spent compiling from source, to account time saved on hits
+};
+
+struct ProgramCacheStats {
+  int             hits;
+  int             misses;
+  int             rejected;
+  int             corrupt;
+  long long       saved;
+  pthread_mutex_t lock; // Programs are also compiled on the hot reload worker
+} programCacheStats = {.lock = PTHREAD_MUTEX_INITIALIZER};
+
+int glProgramCacheSupported() {
+  GLint formats = 0;
+  glGetIntegerv(GL_NUM_PROGRAM_BINARY_FORMATS, &formats);
+  return formats > 0 && glGetProgramBinary && glProgramBinary && glProgramParameteri && !getenv("SHADERPAPER_NO_PROGRAM_CACHE");
+}
+
+uint64_t glProgramCacheKey(const char* fsource, const char* vsource) {
+  uint64_t key = hashString(HASH_SEED, fsource);
+  key          = hashString(key, vsource);
+  key          = hashString(key, (const char*)glGetString(GL_VENDOR));
+  key          = hashString(key, (const char*)glGetString(GL_RENDERER));
+  return hashString(key, (const char*)glGetString(GL_VERSION));
+}
+
+int glProgramCachePath(char* dst, size_t size, uint64_t key) {
+  if (cacheDirectory(dst, size, "programs")) return 1;
+  size_t len = strlen(dst);
+  snprintf(dst + len, size - len, "/%016llx.bin", (unsigned long long)key);
+  return 0;
+}
+
+GLuint glProgramCacheLoad(const char* path, uint64_t key, const char* name) {
+  FILE* file = fopen(path, "rb");
+  if (!file) return 0;
+
+  long long                 begin = monotonicNow();
+  struct ProgramCacheHeader header;
+  struct stat               info;
+  void*                     binary  = NULL;
+  GLuint                    program = 0;
+
+  // The length field is only trusted once it matches the file size
+  int valid = fstat(fileno(file), &info) == 0 && fread(&header, sizeof(header), 1, file) == 1 && !memcmp(header.magic, "SPPROG1", 8) &&
+              header.key == key && header.length == info.st_size - sizeof(header);
+  if (valid) {
+    binary = malloc(header.length);
+    valid  = binary && fread(binary, 1, header.length, file) == header.length;
+  }
+  fclose(file);
+
+  if (!valid) {
+    fprintf(stderr, "[WARN] Corrupt program cache %s for %s, recompiling\n", path, name);
+    pthread_mutex_lock(&programCacheStats.lock);
+    programCacheStats.corrupt++;
+    pthread_mutex_unlock(&programCacheStats.lock);
+    free(binary);
+    unlink(path);
+    return 0;
+  }
+
+  program = glCreateProgram();
+  glProgramBinary(program, header.format, binary, header.length);
+  free(binary);
 
   GLint status;
   glGetProgramiv(program, GL_LINK_STATUS, &status);
   if (status != GL_TRUE) {
-    char log[512];
-    glGetProgramInfoLog(program, sizeof(log), NULL, log);
-    fprintf(stderr, "Program link error:\n%s\n", log);
     glDeleteProgram(program);
+    program = 0;
+  }
+
+  if (!program) {
+    fprintf(stderr, "[WARN] Program binary for %s rejected by the driver, recompiling\n", name);
+    pthread_mutex_lock(&programCacheStats.lock);
+    programCacheStats.rejected++;
+    pthread_mutex_unlock(&programCacheStats.lock);
+    unlink(path);
     return 0;
   }
 
+  long long elapsed = monotonicNow() - begin;
+  pthread_mutex_lock(&programCacheStats.lock);
+  programCacheStats.hits++;
+  programCacheStats.saved += header.compileTime > elapsed ? header.compileTime - elapsed : 0;
+  pthread_mutex_unlock(&programCacheStats.lock);
+  fprintf(stderr, "[OK] Program cache hit for %s (%.2fms, saved %.2fms)\n", name, elapsed / 1e6, (header.compileTime - elapsed) / 1e6);
+  return program;
+}
+
+void glProgramCacheStore(const char* path, uint64_t key, GLuint program, long long compileTime) {
+  GLint length = 0;
+  glGetProgramiv(program, GL_PROGRAM_BINARY_LENGTH, &length);
+  if (length <= 0) return;
+
+  struct ProgramCacheHeader header = {"SPPROG1", key, 0, length, compileTime};
+  void*                     binary = malloc(length);
+  GLenum                    format;
+  glGetProgramBinary(program, length, NULL, &format, binary);
+  header.format = format;
+
+  char tmpPath[MAX_LINE_LENGTH];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", path);
+  FILE* file = fopen(tmpPath, "wb");
+  if (file) {
+    int failed = fwrite(&header, sizeof(header), 1, file) != 1 || fwrite(binary, 1, length, file) != (size_t)length;
+    failed |= fclose(file) != 0;
+    if (failed || rename(tmpPath, path)) unlink(tmpPath);
+  }
+  free(binary);
+}
+
+void glProgramCacheDump(FILE* out) {
+  pthread_mutex_lock(&programCacheStats.lock);
+  fprintf(out, "[CACHE] programs: %d hits, %d misses, %d rejected, %d corrupt, %.2fms saved\n", programCacheStats.hits,
+          programCacheStats.misses, programCacheStats.rejected, programCacheStats.corrupt, programCacheStats.saved / 1e6);
+  pthread_mutex_unlock(&programCacheStats.lock);
+  pthread_mutex_lock(&preprocessCache.lock);
+  fprintf(out, "[CACHE] preprocessor: %d hits, %d misses\n", preprocessCache.hits, preprocessCache.misses);
+  pthread_mutex_unlock(&preprocessCache.lock);
+}
+
+//Compiles shader program from in-memory sources, going through the program binary cache
+GLuint glProgramCompileSource(const char* fsource, const char* vsource, const char* name) {
+  char     path[MAX_LINE_LENGTH];
+  int      cached = glProgramCacheSupported();
+  uint64_t key    = cached ? glProgramCacheKey(fsource, vsource) : 0;
+  cached          = cached && !glProgramCachePath(path, sizeof(path), key);
+
+  if (cached) {
+    GLuint program = glProgramCacheLoad(path, key, name);
+    if (program) return program;
+  }
+
+  long long begin   = monotonicNow();
+  GLuint    program = glProgramLink(glShaderCompileSource(fsource, name, GL_FRAGMENT_SHADER), glShaderCompileSource(vsource, name, GL_VERTEX_SHADER));
+  if (program && cached) {
+    pthread_mutex_lock(&programCacheStats.lock);
+    programCacheStats.misses++;
+    pthread_mutex_unlock(&programCacheStats.lock);
+    glProgramCacheStore(path, key, program, monotonicNow() - begin);
+  }
+  return program;
+}
+
+//Compiles shader program from shader files, expanded by the preprocessor with the given #define block
+GLuint glProgramCompile(const char* fs, const char* vs, const char* defines) {
+  char*  fsource = glslPreprocess(fs, defines);
+  char*  vsource = glslPreprocess(vs, defines);
+  GLuint program = 0;
+  if (fsource && vsource) program = glProgramCompileSource(fsource, vsource, fs);
+  free(fsource);
+  free(vsource);
   return program;
 }
 
+//With KHR_parallel_shader_compile the driver compiles on its own threads and GL_COMPLETION_STATUS_KHR tells when
+//a shader or program is done, so the status can be polled across frames instead of blocking on it
+#define GL_MAX_SHADER_COMPILER_THREADS_KHR 0x91B0
+#define GL_COMPLETION_STATUS_KHR           0x91B1
+
+typedef void (*glMaxShaderCompilerThreadsKHRProc)(GLuint);
+
+int glParallelCompileSupported() {
+  static int supported = -1;
+  if (supported != -1) return supported;
+
+  GLint count = 0;
+  supported   = 0;
+  glGetIntegerv(GL_NUM_EXTENSIONS, &count);
+  for (int i = 0; i < count && !supported; i++) {
+    const char* name = (const char*)glGetStringi(GL_EXTENSIONS, i);
+    supported        = strcmp(name, "GL_KHR_parallel_shader_compile") == 0 || strcmp(name, "GL_ARB_parallel_shader_compile") == 0;
+  }
+  if (!supported) return 0;
+
+  glMaxShaderCompilerThreadsKHRProc maxThreads = (glMaxShaderCompilerThreadsKHRProc)glXGetProcAddressARB((const GLubyte*)"glMaxShaderCompilerThreadsKHR");
+  if (!maxThreads) maxThreads = (glMaxShaderCompilerThreadsKHRProc)glXGetProcAddressARB((const GLubyte*)"glMaxShaderCompilerThreadsARB");
+  if (maxThreads) maxThreads(0xFFFFFFFF); // Let the implementation pick the thread count
+  fprintf(stderr, "[OK] Parallel shader compile available\n");
+  return supported;
+}
+
+enum ProgramBuildState {
+  PROGRAM_BUILD_IDLE = 0,
+  PROGRAM_BUILD_COMPILING,
+  PROGRAM_BUILD_LINKING,
+  PROGRAM_BUILD_DONE,
+  PROGRAM_BUILD_FAILED
+};
+
+struct ProgramBuild {
+  enum ProgramBuildState state;
+  GLuint                 fragShader;
+  GLuint                 vertShader;
+  GLuint                 program;
+  int                    cached; // Store the binary once linked
+  uint64_t               key;
+  long long              begin;
+  char                   cachePath[MAX_LINE_LENGTH];
+  char                   name[MAX_LINE_LENGTH];
+};
+
+int glCompileCompleted(GLuint object, int isProgram) {
+  if (!glParallelCompileSupported()) return 1;
+  GLint completed = GL_TRUE;
+  if (isProgram) glGetProgramiv(object, GL_COMPLETION_STATUS_KHR, &completed);
+  else
+    glGetShaderiv(object, GL_COMPLETION_STATUS_KHR, &completed);
+  return completed == GL_TRUE;
+}
+
+//Starts building a program, loading it straight from the program binary cache when possible
+void glProgramBuildStart(struct ProgramBuild* build, const char* fsource, const char* vsource, const char* name) {
+  memset(build, 0, sizeof(*build));
+  snprintf(build->name, sizeof(build->name), "%s", name);
+  build->cached = glProgramCacheSupported();
+  build->key    = build->cached ? glProgramCacheKey(fsource, vsource) : 0;
+  build->cached = build->cached && !glProgramCachePath(build->cachePath, sizeof(build->cachePath), build->key);
+
+  if (build->cached && (build->program = glProgramCacheLoad(build->cachePath, build->key, name))) {
+    build->state = PROGRAM_BUILD_DONE;
+    return;
+  }
+
+  glParallelCompileSupported();
+  build->begin      = monotonicNow();
+  build->fragShader = glShaderCompileStart(fsource, GL_FRAGMENT_SHADER);
+  build->vertShader = glShaderCompileStart(vsource, GL_VERTEX_SHADER);
+  build->state      = PROGRAM_BUILD_COMPILING;
+}
+
+//Advances the build without waiting on the driver. Returns 1 once it is done or failed.
+//Without parallel compile support every step completes synchronously on the first call.
+int glProgramBuildPoll(struct ProgramBuild* build) {
+  if (build->state == PROGRAM_BUILD_COMPILING) {
+    if (!glCompileCompleted(build->fragShader, 0) || !glCompileCompleted(build->vertShader, 0)) return 0;
+
+    GLuint fragShader = glShaderCheck(build->fragShader, build->name);
+    GLuint vertShader = glShaderCheck(build->vertShader, build->name);
+    if (!fragShader || !vertShader) {
+      if (fragShader) glDeleteShader(fragShader);
+      if (vertShader) glDeleteShader(vertShader);
+      build->state = PROGRAM_BUILD_FAILED;
+      return 1;
+    }
+    build->program = glProgramLinkStart(fragShader, vertShader);
+    build->state   = PROGRAM_BUILD_LINKING;
+  }
+
+  if (build->state == PROGRAM_BUILD_LINKING) {
+    if (!glCompileCompleted(build->program, 1)) return 0;
+
+    build->program = glProgramCheck(build->program);
+    build->state   = build->program ? PROGRAM_BUILD_DONE : PROGRAM_BUILD_FAILED;
+    if (build->program && build->cached) {
+      pthread_mutex_lock(&programCacheStats.lock);
+      programCacheStats.misses++;
+      pthread_mutex_unlock(&programCacheStats.lock);
+      glProgramCacheStore(build->cachePath, build->key, build->program, monotonicNow() - build->begin);
+    }
+    if (build->program) fprintf(stderr, "[OK] Built %s in %.2fms\n", build->name, (monotonicNow() - build->begin) / 1e6);
+  }
+
+  return build->state == PROGRAM_BUILD_DONE || build->state == PROGRAM_BUILD_FAILED;
+}
+
+int glProgramBuildPending(struct ProgramBuild* build) {
+  return build->state == PROGRAM_BUILD_COMPILING || build->state == PROGRAM_BUILD_LINKING;
+}
+
 struct glMesh {
   GLuint vbo;
   GLuint ebo;
@@ -331,120 +1046,700 @@ struct glTexturePack {
   int              textureCount;
 };
 
-struct glTexturePack glTexturePackLoad(int textureCount, char** texturePaths) {
-  struct glTexturePack pack = {0};
-  pack.textureCount         = textureCount;
+//Block compressed textures are read from DDS or KTX2 containers as they are stored, mip levels included.
+//Rows are expected bottom-up like stb_image loads them flipped, which is how shaderpaper-texconv writes them.
+#define GL_COMPRESSED_RGB_S3TC_DXT1_EXT        0x83F0
+#define GL_COMPRESSED_RGBA_S3TC_DXT1_EXT       0x83F1
+#define GL_COMPRESSED_RGBA_S3TC_DXT5_EXT       0x83F3
+#define GL_COMPRESSED_SRGB_S3TC_DXT1_EXT       0x8C4C
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT 0x8C4D
+#define GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT 0x8C4F
 
-  stbi_set_flip_vertically_on_load(1);
-  for (int i = 0; i < textureCount; i++) {
-    char* path            = findfile(texturePaths[i]);
-    pack.textures[i].data = stbi_load(path, &pack.textures[i].width, &pack.textures[i].height, &pack.textures[i].channelCount, 0);
-    free(path);
-  }
+struct CompressedImage {
+  GLenum format;
+  int    width;
+  int    height;
+  int    levelCount;
+  size_t levelOffset[MAX_TEXTURE_LEVELS];
+  size_t levelSize[MAX_TEXTURE_LEVELS];
+};
 
-  for (int i = 0; i < textureCount; i++) {
-    if (pack.textures[i].data) {
-      int  w   = pack.textures[i].width;
-      int  h   = pack.textures[i].height;
-      int  c   = pack.textures[i].channelCount;
-      char hdr = pack.textures[i].hdr;
-
-      glGenTextures(1, &pack.textures[i].id);
-      glBindTexture(GL_TEXTURE_2D, pack.textures[i].id);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-      glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-      GLenum format = GL_RGB;
-      if (c == 4) format = GL_RGBA;
-      else if (c == 1)
-        format = GL_RED;
-      glTexImage2D(GL_TEXTURE_2D, 0, format, w, h, 0, format, GL_UNSIGNED_BYTE, pack.textures[i].data);
-      glGenerateMipmap(GL_TEXTURE_2D);
+int compressedBlockBytes(GLenum format) {
+  switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT: return 8;
+    default: return 16;
+  }
+}
 
-      free(pack.textures[i].data);
-    }
+const char* compressedFormatName(GLenum format) {
+  switch (format) {
+    case GL_COMPRESSED_RGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_RGBA_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_S3TC_DXT1_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT: return "BC1";
+    case GL_COMPRESSED_RGBA_S3TC_DXT5_EXT:
+    case GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT: return "BC3";
+    default: return "BC7";
   }
-  return pack;
 }
 
-void glTexturePackDispose(struct glTexturePack* textures) {
-  GLuint textureIds[MAX_TEXTURE_SLOTS];
-  for (int i = 0; i < textures->textureCount; i++)
-    textureIds[i] = textures->textures[i].id;
-  glDeleteTextures(textures->textureCount, textureIds);
+int compressedPath(const char* path) {
+  const char* extension = strrchr(path, '.');
+  return extension && (strcasecmp(extension, ".dds") == 0 || strcasecmp(extension, ".ktx2") == 0);
 }
 
-//===================================================[TEXTURE ARRAY]===================================================
+int compressedFormatSupported(GLenum format) {
+  GLint count = 0;
+  glGetIntegerv(GL_NUM_COMPRESSED_TEXTURE_FORMATS, &count);
+  GLint* formats = malloc((count + 1) * sizeof(GLint));
+  glGetIntegerv(GL_COMPRESSED_TEXTURE_FORMATS, formats);
 
-GLuint glTextureArrayLoad(int textureCount, const char** texturePaths) {
-  GLuint textureArrayId;
-  glGenTextures(1, &textureArrayId);
-  glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayId);
+  int supported = 0;
+  for (int i = 0; i < count && !supported; i++) supported = formats[i] == (GLint)format;
+  free(formats);
+  return supported;
+}
 
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+//Fills the level table, levels follow each other from offset on
+int compressedLevels(struct CompressedImage* image, size_t offset, size_t fileSize) {
+  int width  = image->width;
+  int height = image->height;
+  if (image->levelCount < 1) image->levelCount = 1;
+  if (image->levelCount > MAX_TEXTURE_LEVELS) image->levelCount = MAX_TEXTURE_LEVELS;
+
+  for (int i = 0; i < image->levelCount; i++) {
+    image->levelOffset[i] = offset;
+    image->levelSize[i]   = (size_t)((width + 3) / 4) * ((height + 3) / 4) * compressedBlockBytes(image->format);
+    offset += image->levelSize[i];
+    if (offset > fileSize) return 1;
+    width  = width > 1 ? width / 2 : 1;
+    height = height > 1 ? height / 2 : 1;
+  }
+  return 0;
+}
 
-  int    width = 0, height = 0, channels = 0;
-  void*  data = NULL;
-  GLenum format;
+uint32_t readU32(const unsigned char* data) {
+  return data[0] | data[1] << 8 | data[2] << 16 | (uint32_t)data[3] << 24;
+}
 
-  data = stbi_load(texturePaths[0], &width, &height, &channels, 0);
-  if (!data) {
-    printf("Failed to load initial texture for array: %s\n", texturePaths[0]);
-    return 0;
+int ddsParse(const unsigned char* data, size_t size, struct CompressedImage* image) {
+  if (size < 128 || memcmp(data, "DDS ", 4) != 0 || readU32(data + 4) != 124) return 1;
+
+  image->height     = readU32(data + 12);
+  image->width      = readU32(data + 16);
+  image->levelCount = readU32(data + 28);
+
+  size_t offset = 128;
+  if (memcmp(data + 84, "DXT1", 4) == 0) image->format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT;
+  else if (memcmp(data + 84, "DXT5", 4) == 0) image->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT;
+  else if (memcmp(data + 84, "DX10", 4) == 0 && size >= 148) {
+    offset = 148;
+    switch (readU32(data + 128)) { // DXGI_FORMAT
+      case 71: image->format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+      case 72: image->format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; break;
+      case 77: image->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+      case 78: image->format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; break;
+      case 98: image->format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+      case 99: image->format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; break;
+      default: return 1;
+    }
+  } else return 1;
+
+  return compressedLevels(image, offset, size);
+}
+
+int ktx2Parse(const unsigned char* data, size_t size, struct CompressedImage* image) {
+  static const unsigned char identifier[12] = {0xAB, 'K', 'T', 'X', ' ', '2', '0', 0xBB, '\r', '\n', 0x1A, '\n'};
+  if (size < 80 || memcmp(data, identifier, 12) != 0) return 1;
+
+  // Only plain 2D textures without supercompression
+  if (readU32(data + 28) > 1 || readU32(data + 32) > 1 || readU32(data + 36) != 1 || readU32(data + 44) != 0) return 1;
+  image->width      = readU32(data + 20);
+  image->height     = readU32(data + 24);
+  image->levelCount = readU32(data + 40);
+
+  switch (readU32(data + 12)) { // VkFormat
+    case 131: image->format = GL_COMPRESSED_RGB_S3TC_DXT1_EXT; break;
+    case 132: image->format = GL_COMPRESSED_SRGB_S3TC_DXT1_EXT; break;
+    case 133: image->format = GL_COMPRESSED_RGBA_S3TC_DXT1_EXT; break;
+    case 134: image->format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT1_EXT; break;
+    case 137: image->format = GL_COMPRESSED_RGBA_S3TC_DXT5_EXT; break;
+    case 138: image->format = GL_COMPRESSED_SRGB_ALPHA_S3TC_DXT5_EXT; break;
+    case 145: image->format = GL_COMPRESSED_RGBA_BPTC_UNORM; break;
+    case 146: image->format = GL_COMPRESSED_SRGB_ALPHA_BPTC_UNORM; break;
+    default: return 1;
   }
 
-  if (channels == 4) {
-    format = GL_RGBA;
-  } else if (channels == 3) {
-    format = GL_RGB;
-  } else if (channels == 1) {
-    format = GL_RED;
-  } else {
-    printf("Unsupported channel count: %d\n", channels);
-    stbi_image_free(data);
-    return 0;
+  if (compressedLevels(image, 0, size)) return 1;
+  if (80 + (size_t)image->levelCount * 24 > size) return 1;
+
+  // The level index stores each level explicitly, level 0 first
+  for (int i = 0; i < image->levelCount; i++) {
+    const unsigned char* level  = data + 80 + i * 24;
+    uint64_t             offset = readU32(level) | (uint64_t)readU32(level + 4) << 32;
+    uint64_t             length = readU32(level + 8) | (uint64_t)readU32(level + 12) << 32;
+    if (length != image->levelSize[i] || offset + length > size) return 1;
+    image->levelOffset[i] = offset;
   }
+  return 0;
+}
 
-  glTexStorage3D(GL_TEXTURE_2D_ARRAY, 1, GL_RGBA8, width, height, textureCount);
+//Decoded textures are cached in ~/.cache/shaderpaper/textures as flipped, channel expanded texels with their mip
+//chain, every level starting on a page boundary so a hit is uploaded straight from the mapped file.
+//Files are keyed by the source path, mtime, size and the downscale limit; the least recently used ones are removed
+//above the size limit.
+struct TextureCacheHeader {
+  char     magic[8]; // "SPTEX2"
+  uint64_t key;
+  int32_t  width;
+  int32_t  height;
+  int32_t  sourceWidth; // Size of the image on disk, larger when it was downscaled
+  int32_t  sourceHeight;
+  int32_t  channels;
+  int32_t  levelCount;
+  uint64_t levelOffset[MAX_TEXTURE_LEVELS];
+};
 
-  for (int i = 0; i < textureCount; i++) {
-    int   layerWidth, layerHeight, layerChannels;
-    void* layerData = stbi_load(texturePaths[i], &layerWidth, &layerHeight, &layerChannels, 0);
+struct TextureCacheStats {
+  int hits;
+  int misses;
+  int evicted;
+} textureCacheStats;
 
-    if (layerWidth != width || layerHeight != height) {
-      printf("Texture %s has mismatched dimensions and cannot be added to the array.\n", texturePaths[i]);
-      stbi_image_free(layerData);
-      continue;
-    }
+long long textureCacheLimit = TEXTURE_CACHE_MB * 1000000LL; // Bytes, from [general] texturecachemb, 0 disables the cache
 
-    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, layerWidth, layerHeight, 1, format, GL_UNSIGNED_BYTE, layerData);
-    stbi_image_free(layerData);
-  }
+int textureCachePath(char* dst, size_t size, const char* path, int maxWidth, int maxHeight, enum ResampleFilter filter, uint64_t* key) {
+  struct stat info;
+  if (textureCacheLimit <= 0 || stat(path, &info) || cacheDirectory(dst, size, "textures")) return 1;
 
-  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
-  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
-  return textureArrayId;
+  int limit[3] = {maxWidth, maxHeight, filter};
+  *key         = hashString(HASH_SEED, path);
+  *key         = hashBytes(*key, &info.st_mtim, sizeof(info.st_mtim));
+  *key         = hashBytes(*key, &info.st_size, sizeof(info.st_size));
+  *key         = hashBytes(*key, limit, sizeof(limit));
+
+  size_t len = strlen(dst);
+  snprintf(dst + len, size - len, "/%016llx.tex", (unsigned long long)*key);
+  return 0;
 }
 
-void glTextureArrayDispose(GLuint textureArrayId) {
-  glDeleteTextures(1, &textureArrayId);
+size_t textureLevelSize(int width, int height, int channels, int level) {
+  width  = width >> level > 0 ? width >> level : 1;
+  height = height >> level > 0 ? height >> level : 1;
+  return (size_t)width * height * channels;
 }
 
-//=========================================================[CUBEMAP]==========================================================
+//Levels of a full mip chain down to 1x1
+int textureLevelCount(int width, int height) {
+  int count = 1;
+  while (count < MAX_TEXTURE_LEVELS && (width >> count > 0 || height >> count > 0)) count++;
+  return count;
+}
 
+size_t textureChainSize(int width, int height, int channels) {
+  size_t size = 0;
+  for (int i = 0; i < textureLevelCount(width, height); i++) size += textureLevelSize(width, height, channels, i);
+  return size;
+}
 
-GLuint glCubemapLoad(const char** faces) {
-  GLuint cubemapId;
-  glGenTextures(1, &cubemapId);
-  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapId);
+//Fills every level after the first of a mip chain stored tightly packed, level after level
+void textureChainBuild(unsigned char* chain, int width, int height, int channels) {
+  for (int i = 1; i < textureLevelCount(width, height); i++) {
+    size_t size = textureLevelSize(width, height, channels, i - 1);
+    resampleHalf(chain, width >> (i - 1) > 0 ? width >> (i - 1) : 1, height >> (i - 1) > 0 ? height >> (i - 1) : 1, channels, chain + size);
+    chain += size;
+  }
+}
 
-  int width, height, channels;
+//Writes a packed mip chain with page aligned levels, through a temporary file so readers never see a partial one
+int textureCacheStore(const char* cachePath, uint64_t key, const unsigned char* chain, int width, int height, int channels, int sourceWidth,
+                      int sourceHeight) {
+  struct TextureCacheHeader header = {0};
+  long                      page   = sysconf(_SC_PAGESIZE);
+  size_t                    offset = page;
+  memcpy(header.magic, "SPTEX2", 7);
+  header.key          = key;
+  header.width        = width;
+  header.height       = height;
+  header.sourceWidth  = sourceWidth;
+  header.sourceHeight = sourceHeight;
+  header.channels     = channels;
+  header.levelCount   = textureLevelCount(width, height);
+
+  for (int i = 0; i < header.levelCount; i++) {
+    header.levelOffset[i] = offset;
+    offset += (textureLevelSize(width, height, channels, i) + page - 1) / page * page;
+  }
 
-  for (unsigned int i = 0; i < 6; i++) {
+  char temporary[MAX_LINE_LENGTH];
+  snprintf(temporary, sizeof(temporary), "%s.%d.tmp", cachePath, (int)getpid());
+  int fd = open(temporary, O_RDWR | O_CREAT | O_TRUNC, 0644);
+  if (fd < 0) return 1;
+
+  // Blocks are allocated up front, a full disk fails here instead of raising SIGBUS on a write to the mapping
+  unsigned char* file = MAP_FAILED;
+  if (posix_fallocate(fd, 0, offset) == 0) file = mmap(NULL, offset, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+  close(fd);
+  if (file == MAP_FAILED) {
+    unlink(temporary);
+    return 1;
+  }
+
+  memcpy(file, &header, sizeof(header));
+  for (int i = 0; i < header.levelCount; i++) {
+    memcpy(file + header.levelOffset[i], chain, textureLevelSize(width, height, channels, i));
+    chain += textureLevelSize(width, height, channels, i);
+  }
+  munmap(file, offset);
+  return rename(temporary, cachePath);
+}
+
+//Maps a cached texture and checks it is complete, returns the mapping or NULL on a miss
+unsigned char* textureCacheOpen(const char* cachePath, uint64_t key, size_t* size) {
+  int fd = open(cachePath, O_RDONLY);
+  if (fd < 0) return NULL;
+
+  struct stat info;
+  void*       file = MAP_FAILED;
+  if (fstat(fd, &info) == 0 && info.st_size >= (off_t)sizeof(struct TextureCacheHeader))
+    file = mmap(NULL, info.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+  futimens(fd, NULL); // Recently used, kept longest by textureCacheTrim
+  close(fd);
+  if (file == MAP_FAILED) return NULL;
+
+  struct TextureCacheHeader* header = file;
+  int                        valid  = memcmp(header->magic, "SPTEX2", 7) == 0 && header->key == key;
+  valid                             = valid && header->width > 0 && header->height > 0 && header->channels > 0 && header->channels <= 4;
+  valid                             = valid && header->levelCount > 0 && header->levelCount <= MAX_TEXTURE_LEVELS;
+  for (int i = 0; valid && i < header->levelCount; i++)
+    valid = header->levelOffset[i] + textureLevelSize(header->width, header->height, header->channels, i) <= (uint64_t)info.st_size;
+  if (!valid) {
+    fprintf(stderr, "[WARN] Corrupt texture cache entry %s removed\n", cachePath);
+    munmap(file, info.st_size);
+    unlink(cachePath);
+    return NULL;
+  }
+
+  *size = info.st_size;
+  return file;
+}
+
+//Removes least recently used entries until the cache fits its size limit
+void textureCacheTrim() {
+  textureCacheStats.evicted += cacheDirectoryTrim("textures", ".tex", textureCacheLimit);
+}
+
+//A texture decoded on the worker pool and copied into the mapped pixel unpack buffer it is uploaded from
+struct TextureDecodeJob {
+  char*                  path;
+  int                    width; // Uploaded size, smaller than the source when it is downscaled
+  int                    height;
+  int                    sourceWidth; // Size from stbi_info, the decoded image has to match it
+  int                    sourceHeight;
+  int                    channels; // Requested from stbi_load
+  GLuint                 pbo;
+  unsigned char*         mapped;
+  int                    state; // 0 queued, 1 decoded (or failed), 2 uploaded
+  int                    failed;
+  long long              decodeTime;
+  size_t                 fileSize; // Compressed containers are read into the buffer as they are
+  struct CompressedImage compressed;
+  uint64_t               cacheKey; // Decoded texels are stored in the texture cache under cachePath when set
+  char                   cachePath[MAX_LINE_LENGTH];
+  unsigned char*         decoded;
+};
+
+struct TextureDecodeQueue {
+  struct TextureDecodeJob* jobs;
+  int                      count;
+  int                      next;
+  enum ResampleFilter      filter;
+  int                      resampleThreads; // Per decode worker, so downscaling a single large image uses every core
+  pthread_mutex_t          lock;
+  pthread_cond_t           decoded;
+};
+
+//Reads a DDS or KTX2 file and locates its levels, then copies it into the mapped buffer. The headers are parsed from
+//a heap copy since the buffer is mapped write only
+int textureDecodeCompressed(struct TextureDecodeJob* job) {
+  unsigned char* data   = malloc(job->fileSize);
+  FILE*          file   = fopen(job->path, "rb");
+  int            failed = !data || !file || fread(data, 1, job->fileSize, file) != job->fileSize;
+  if (file) fclose(file);
+
+  if (!failed && strcasecmp(strrchr(job->path, '.'), ".dds") == 0) failed = ddsParse(data, job->fileSize, &job->compressed);
+  else if (!failed) failed = ktx2Parse(data, job->fileSize, &job->compressed);
+  if (!failed) memcpy(job->mapped, data, job->fileSize);
+  free(data);
+  return failed;
+}
+
+//Decodes, downscales and builds the mip chain on the heap (the buffer is mapped write only), then copies the chain
+//into the mapped buffer. The chain is kept in job->decoded for the texture cache
+int textureDecodeImage(struct TextureDecodeJob* job, struct TextureDecodeQueue* queue) {
+  int            width, height, channels;
+  size_t         size   = textureChainSize(job->width, job->height, job->channels);
+  unsigned char* pixels = stbi_load(job->path, &width, &height, &channels, job->channels);
+  if (!pixels || width != job->sourceWidth || height != job->sourceHeight || !(job->decoded = malloc(size))) {
+    stbi_image_free(pixels);
+    return 1;
+  }
+
+  if (width != job->width || height != job->height)
+    resampleImage(pixels, width, height, job->channels, job->decoded, job->width, job->height, queue->filter, queue->resampleThreads);
+  else memcpy(job->decoded, pixels, textureLevelSize(width, height, job->channels, 0));
+  stbi_image_free(pixels);
+
+  textureChainBuild(job->decoded, job->width, job->height, job->channels);
+  memcpy(job->mapped, job->decoded, size);
+  return 0;
+}
+
+void* textureDecodeWorker(void* arg) {
+  struct TextureDecodeQueue* queue = arg;
+  stbi_set_flip_vertically_on_load_thread(1);
+
+  for (;;) {
+    pthread_mutex_lock(&queue->lock);
+    int index = queue->next++;
+    pthread_mutex_unlock(&queue->lock);
+    if (index >= queue->count) break;
+
+    struct TextureDecodeJob* job = &queue->jobs[index];
+    if (job->state) continue;
+
+    long long begin  = monotonicNow();
+    int       failed = !job->mapped || (job->fileSize ? textureDecodeCompressed(job) : textureDecodeImage(job, queue));
+
+    pthread_mutex_lock(&queue->lock);
+    job->decodeTime = monotonicNow() - begin;
+    job->failed     = failed;
+    job->state      = 1;
+    pthread_cond_signal(&queue->decoded);
+    pthread_mutex_unlock(&queue->lock);
+
+    // The entry is written while the GL thread uploads, glTexturePackLoad returns once it is written
+    if (!failed && job->decoded && job->cacheKey &&
+        textureCacheStore(job->cachePath, job->cacheKey, job->decoded, job->width, job->height, job->channels, job->sourceWidth, job->sourceHeight))
+      fprintf(stderr, "[WARN] Cannot write texture cache entry %s\n", job->cachePath);
+    free(job->decoded);
+  }
+  return NULL;
+}
+
+//Creates and binds a repeating, linearly filtered 2D texture
+GLuint glTextureCreate() {
+  GLuint id;
+  glGenTextures(1, &id);
+  glBindTexture(GL_TEXTURE_2D, id);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR); // Every upload path fills the mip chain up to MAX_LEVEL
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  return id;
+}
+
+//Uploads every level of a texture cache entry from its mapped pages
+void glTextureUploadCached(struct glTexture* texture, const unsigned char* file) {
+  const struct TextureCacheHeader* header = (const struct TextureCacheHeader*)file;
+  GLenum                           format = header->channels == 4 ? GL_RGBA : header->channels == 3 ? GL_RGB : header->channels == 2 ? GL_RG : GL_RED;
+
+  texture->id = glTextureCreate();
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0); // A miss earlier in the pack leaves its buffer bound, levels are client memory here
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < header->levelCount; i++) {
+    int width  = header->width >> i > 0 ? header->width >> i : 1;
+    int height = header->height >> i > 0 ? header->height >> i : 1;
+    glTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, format, GL_UNSIGNED_BYTE, file + header->levelOffset[i]);
+  }
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, header->levelCount - 1);
+
+  texture->width        = header->width;
+  texture->height       = header->height;
+  texture->channelCount = header->channels;
+}
+
+//Uploads the texture from the cache if it has an entry for it, otherwise leaves the job set up to store one
+int glTextureCacheLoad(struct glTexture* texture, struct TextureDecodeJob* job, int maxWidth, int maxHeight, enum ResampleFilter filter) {
+  if (textureCachePath(job->cachePath, sizeof(job->cachePath), job->path, maxWidth, maxHeight, filter, &job->cacheKey)) return 0;
+
+  size_t         size;
+  long long      begin = monotonicNow();
+  unsigned char* file  = textureCacheOpen(job->cachePath, job->cacheKey, &size);
+  if (!file) {
+    textureCacheStats.misses++;
+    return 0;
+  }
+
+  const struct TextureCacheHeader* header = (const struct TextureCacheHeader*)file;
+  job->width                              = header->width;
+  job->height                             = header->height;
+  job->sourceWidth                        = header->sourceWidth;
+  job->sourceHeight                       = header->sourceHeight;
+  job->channels                           = header->channels;
+  glTextureUploadCached(texture, file);
+  munmap(file, size);
+  textureCacheStats.hits++;
+  fprintf(stderr, "[TEXTURE] %s %dx%d: cached, upload %.1fms\n", job->path, texture->width, texture->height, (monotonicNow() - begin) / 1e6);
+  return 1;
+}
+
+void glTextureUpload(struct glTexture* texture, struct TextureDecodeJob* job) {
+  long long begin = monotonicNow();
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+  if (job->mapped) glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+  struct CompressedImage* image = &job->compressed;
+  if (!job->failed && job->fileSize && !compressedFormatSupported(image->format)) {
+    fprintf(stderr, "[ERR] %s is not supported by the driver\n", compressedFormatName(image->format));
+    job->failed = 1;
+  }
+
+  if (!job->failed) texture->id = glTextureCreate();
+
+  if (!job->failed && job->fileSize) {
+    for (int i = 0, width = image->width, height = image->height; i < image->levelCount; i++) {
+      glCompressedTexImage2D(GL_TEXTURE_2D, i, image->format, width, height, 0, image->levelSize[i], (void*)image->levelOffset[i]);
+      width  = width > 1 ? width / 2 : 1;
+      height = height > 1 ? height / 2 : 1;
+    }
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, image->levelCount - 1);
+
+    texture->width        = image->width;
+    texture->height       = image->height;
+    texture->channelCount = 4;
+  } else if (!job->failed) {
+    GLenum format     = job->channels == 4 ? GL_RGBA : job->channels == 3 ? GL_RGB : GL_RED;
+    int    levelCount = textureLevelCount(job->width, job->height);
+    size_t offset     = 0;
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+    for (int i = 0; i < levelCount; i++) {
+      int width  = job->width >> i > 0 ? job->width >> i : 1;
+      int height = job->height >> i > 0 ? job->height >> i : 1;
+      glTexImage2D(GL_TEXTURE_2D, i, format, width, height, 0, format, GL_UNSIGNED_BYTE, (void*)offset);
+      offset += textureLevelSize(job->width, job->height, job->channels, i);
+    }
+    glPixelStorei(GL_UNPACK_ALIGNMENT, 4);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, levelCount - 1);
+
+    texture->width        = job->width;
+    texture->height       = job->height;
+    texture->channelCount = job->channels;
+  }
+  glDeleteBuffers(1, &job->pbo);
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+  job->state = 2;
+
+  if (job->failed) fprintf(stderr, "[ERR] Texture %s could not be decoded\n", job->path);
+  else if (job->fileSize)
+    fprintf(stderr, "[TEXTURE] %s %dx%d %s, %d levels: read %.1fms, upload %.1fms\n", job->path, image->width, image->height,
+            compressedFormatName(image->format), image->levelCount, job->decodeTime / 1e6, (monotonicNow() - begin) / 1e6);
+  else if (job->width != job->sourceWidth || job->height != job->sourceHeight)
+    fprintf(stderr, "[TEXTURE] %s %dx%d downscaled to %dx%d: decode %.1fms, upload %.1fms\n", job->path, job->sourceWidth, job->sourceHeight,
+            job->width, job->height, job->decodeTime / 1e6, (monotonicNow() - begin) / 1e6);
+  else fprintf(stderr, "[TEXTURE] %s %dx%d: decode %.1fms, upload %.1fms\n", job->path, job->width, job->height, job->decodeTime / 1e6, (monotonicNow() - begin) / 1e6);
+}
+
+//Shrinks width x height to the smallest size still covering maxWidth x maxHeight, keeping the aspect ratio
+void textureFitSize(int* width, int* height, int maxWidth, int maxHeight) {
+  if (maxWidth <= 0 || maxHeight <= 0) return;
+  float scale = fmaxf((float)maxWidth / *width, (float)maxHeight / *height);
+  if (scale >= 1.0f) return;
+  *width  = fmaxf(1.0f, roundf(*width * scale));
+  *height = fmaxf(1.0f, roundf(*height * scale));
+}
+
+//Decodes the textures on a pool of threads and uploads each one as soon as its decode finishes.
+//With a filter, images larger than maxWidth x maxHeight are downscaled on the CPU before upload
+struct glTexturePack glTexturePackLoad(int textureCount, char** texturePaths, int maxWidth, int maxHeight, enum ResampleFilter filter) {
+  struct glTexturePack      pack  = {0};
+  struct TextureDecodeQueue queue = {0};
+  pack.textureCount               = textureCount;
+  if (textureCount == 0) return pack;
+
+  long long begin = monotonicNow();
+  queue.jobs      = calloc(textureCount, sizeof(struct TextureDecodeJob));
+  queue.count     = textureCount;
+  queue.filter    = filter;
+  if (filter == RESAMPLE_NONE) maxWidth = maxHeight = 0;
+  pthread_mutex_init(&queue.lock, NULL);
+  pthread_cond_init(&queue.decoded, NULL);
+
+  // Headers are read up front to size the unpack buffers, which can only be mapped on the GL thread
+  for (int i = 0; i < textureCount; i++) {
+    struct TextureDecodeJob* job = &queue.jobs[i];
+    struct stat              info;
+    int                      channels = 4;
+    job->path = findfile(texturePaths[i]);
+    if (job->path && compressedPath(job->path) && stat(job->path, &info) == 0 && info.st_size > 0) {
+      job->fileSize = info.st_size;
+    } else if (job->path && glTextureCacheLoad(&pack.textures[i], job, maxWidth, maxHeight, filter)) {
+      job->state = 2;
+      continue;
+    }
+
+    if (!job->fileSize && (!job->path || !stbi_info(job->path, &job->sourceWidth, &job->sourceHeight, &channels))) {
+      fprintf(stderr, "[ERR] Texture %s not found or not an image\n", texturePaths[i]);
+      job->failed = 1;
+      job->state  = 2;
+      continue;
+    }
+    job->channels = channels == 1 || channels == 3 ? channels : 4;
+    job->width    = job->sourceWidth;
+    job->height   = job->sourceHeight;
+    textureFitSize(&job->width, &job->height, maxWidth, maxHeight);
+
+    GLsizeiptr size = job->fileSize ? (GLsizeiptr)job->fileSize : (GLsizeiptr)textureChainSize(job->width, job->height, job->channels);
+    glGenBuffers(1, &job->pbo);
+    glBindBuffer(GL_PIXEL_UNPACK_BUFFER, job->pbo);
+    glBufferData(GL_PIXEL_UNPACK_BUFFER, size, NULL, GL_STREAM_DRAW);
+    job->mapped = glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, size, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_BUFFER_BIT);
+  }
+  glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+  int pending = 0;
+  for (int i = 0; i < textureCount; i++) pending += queue.jobs[i].state == 0;
+
+  long      cores       = sysconf(_SC_NPROCESSORS_ONLN);
+  int       threadCount = pending < cores ? pending : (int)cores;
+  pthread_t threads[MAX_DECODE_THREADS];
+  if (threadCount > MAX_DECODE_THREADS) threadCount = MAX_DECODE_THREADS;
+  queue.resampleThreads = threadCount ? cores / threadCount : 1;
+  for (int i = 0; i < threadCount; i++) pthread_create(&threads[i], NULL, textureDecodeWorker, &queue);
+
+  for (;;) {
+    pthread_mutex_lock(&queue.lock);
+    int ready     = -1;
+    int remaining = 0;
+    for (int i = 0; i < textureCount; i++) {
+      if (queue.jobs[i].state == 1 && ready == -1) ready = i;
+      if (queue.jobs[i].state != 2) remaining++;
+    }
+    if (ready == -1 && remaining) pthread_cond_wait(&queue.decoded, &queue.lock);
+    pthread_mutex_unlock(&queue.lock);
+
+    if (!remaining) break;
+    if (ready != -1) glTextureUpload(&pack.textures[ready], &queue.jobs[ready]);
+  }
+
+  for (int i = 0; i < threadCount; i++) pthread_join(threads[i], NULL);
+
+  // Downscaled textures save their difference in texels over the whole mip chain
+  double saved = 0;
+  for (int i = 0; i < textureCount; i++) {
+    struct TextureDecodeJob* job = &queue.jobs[i];
+    if (!job->failed && !job->fileSize)
+      saved += ((double)job->sourceWidth * job->sourceHeight - (double)job->width * job->height) * job->channels * 4.0 / 3.0;
+  }
+  for (int i = 0; i < textureCount; i++) free(queue.jobs[i].path);
+  free(queue.jobs);
+  pthread_mutex_destroy(&queue.lock);
+  pthread_cond_destroy(&queue.decoded);
+
+  if (textureCacheStats.misses) textureCacheTrim();
+  fprintf(stderr, "[TEXTURE] %d textures loaded in %.1fms on %d threads, cache: %d hits, %d misses, %d evicted\n", textureCount,
+          (monotonicNow() - begin) / 1e6, threadCount, textureCacheStats.hits, textureCacheStats.misses, textureCacheStats.evicted);
+  if (saved > 0) fprintf(stderr, "[TEXTURE] Downscaling to %dx%d saved %.1f MB of VRAM\n", maxWidth, maxHeight, saved / 1e6);
+  return pack;
+}
+
+void glTexturePackDispose(struct glTexturePack* textures) {
+  GLuint textureIds[MAX_TEXTURE_SLOTS];
+  for (int i = 0; i < textures->textureCount; i++)
+    textureIds[i] = textures->textures[i].id;
+  glDeleteTextures(textures->textureCount, textureIds);
+}
+
+//===================================================[TEXTURE ARRAY]===================================================
+
+//Packs the images into the layers of one RGBA8 array with a full mip chain. Layers take the size of the first readable
+//image, downscaled with filter to cover maxWidth x maxHeight, other sizes are resampled to it and every layer is expanded
+//to four channels so RGB and RGBA sources share the array format
+GLuint glTextureArrayLoad(int textureCount, char** texturePaths, int maxWidth, int maxHeight, enum ResampleFilter filter) {
+  long long begin = monotonicNow();
+  char*     paths[MAX_TEXTURE_SLOTS];
+  int       width = 0, height = 0, channels;
+  for (int i = 0; i < textureCount; i++) {
+    paths[i] = findfile(texturePaths[i]);
+    if (!width && paths[i] && !stbi_info(paths[i], &width, &height, &channels)) width = 0;
+  }
+  if (!width) {
+    fprintf(stderr, "[ERR] No texture of the array could be read\n");
+    for (int i = 0; i < textureCount; i++) free(paths[i]);
+    return 0;
+  }
+  if (filter != RESAMPLE_NONE) textureFitSize(&width, &height, maxWidth, maxHeight);
+
+  long cores  = sysconf(_SC_NPROCESSORS_ONLN);
+  int  levels = textureLevelCount(width, height);
+
+  GLuint textureArrayId;
+  glGenTextures(1, &textureArrayId);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, textureArrayId);
+
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_REPEAT);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+
+  // Immutable storage needs GL 4.2 or ARB_texture_storage, older drivers get every level allocated by hand
+  if (glTexStorage3D) glTexStorage3D(GL_TEXTURE_2D_ARRAY, levels, GL_RGBA8, width, height, textureCount);
+  else {
+    for (int i = 0; i < levels; i++)
+      glTexImage3D(GL_TEXTURE_2D_ARRAY, i, GL_RGBA8, width >> i > 0 ? width >> i : 1, height >> i > 0 ? height >> i : 1, textureCount, 0, GL_RGBA,
+                   GL_UNSIGNED_BYTE, NULL);
+    glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAX_LEVEL, levels - 1);
+  }
+
+  unsigned char* layer = malloc((size_t)width * height * 4);
+  stbi_set_flip_vertically_on_load_thread(1); // Same orientation as the 2D user textures
+  for (int i = 0; i < textureCount; i++) {
+    int                  layerWidth, layerHeight, layerChannels;
+    unsigned char*       pixels = paths[i] ? stbi_load(paths[i], &layerWidth, &layerHeight, &layerChannels, 4) : NULL;
+    const unsigned char* source = pixels;
+
+    if (!pixels) {
+      fprintf(stderr, "[ERR] Texture %s not found or not an image, layer %d left black\n", texturePaths[i], i);
+      memset(layer, 0, (size_t)width * height * 4);
+      source = layer;
+    } else if (layerWidth != width || layerHeight != height) {
+      fprintf(stderr, "[TEXTURE] %s %dx%d resampled to %dx%d for layer %d\n", paths[i], layerWidth, layerHeight, width, height, i);
+      resampleImage(pixels, layerWidth, layerHeight, 4, layer, width, height, filter != RESAMPLE_NONE ? filter : RESAMPLE_LANCZOS, cores);
+      source = layer;
+    }
+
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, i, width, height, 1, GL_RGBA, GL_UNSIGNED_BYTE, source);
+    stbi_image_free(pixels);
+    free(paths[i]);
+  }
+  stbi_set_flip_vertically_on_load_thread(0);
+  free(layer);
+
+  glGenerateMipmap(GL_TEXTURE_2D_ARRAY);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+  fprintf(stderr, "[TEXTURE] %d layers of %dx%d with %d levels packed in %.1fms\n", textureCount, width, height, levels, (monotonicNow() - begin) / 1e6);
+  return textureArrayId;
+}
+
+void glTextureArrayDispose(GLuint textureArrayId) {
+  glDeleteTextures(1, &textureArrayId);
+}
+
+//=========================================================[CUBEMAP]==========================================================
+
+
+GLuint glCubemapLoad(const char** faces) {
+  GLuint cubemapId;
+  glGenTextures(1, &cubemapId);
+  glBindTexture(GL_TEXTURE_CUBE_MAP, cubemapId);
+
+  int width, height, channels;
+
+  for (unsigned int i = 0; i < 6; i++) {
     unsigned char* data = stbi_load(faces[i], &width, &height, &channels, 0);
     if (data) {
       GLenum format;
@@ -478,77 +1773,622 @@ void glCubemapDispose(GLuint cubemapId) {
 
 //====================================================[FRAMEBUFFER]============================================================
 
+#ifndef GL_R11F_G11F_B10F
+#define GL_R11F_G11F_B10F 0x8C3A
+#endif
+
+//Layout of a framebuffer: a color format per render target and whether it needs a depth attachment
+struct glFrameBufferDesc {
+  int    width;
+  int    height;
+  int    rtcount;
+  GLenum formats[MAX_RENDER_TARGETS];
+  int    depth;
+};
+
 struct glFrameBuffer {
   GLuint fbo;
-  GLuint rt[8];
-  GLuint ds;
+  GLuint rt[MAX_RENDER_TARGETS];
+  GLuint ds; // 0 without depth attachment
   int    rtcount;
   int    width;
   int    height;
+  GLenum formats[MAX_RENDER_TARGETS];
+  size_t bytes; // Video memory used by the attachments
 };
 
-int glFrameBufferCreate(struct glFrameBuffer* framebuffer, int width, int height) {
-  GLuint fbo, colorTex, depthRb;
+struct FrameBufferStats {
+  int       count;
+  long long bytes;
+  long long peak;
+} framebufferStats;
+
+//Single color target framebuffer without depth, what full screen passes need
+struct glFrameBufferDesc glFrameBufferColor(int width, int height, GLenum format) {
+  struct glFrameBufferDesc desc = {0};
+  desc.width                    = width;
+  desc.height                   = height;
+  desc.rtcount                  = 1;
+  desc.formats[0]               = format;
+  return desc;
+}
+
+//Pixel layout and type used to allocate storage of an internal format
+GLenum glFormatLayout(GLenum format) {
+  switch (format) {
+    case GL_R8: return GL_RED;
+    case GL_R11F_G11F_B10F: return GL_RGB;
+    default: return GL_RGBA;
+  }
+}
+
+GLenum glFormatType(GLenum format) {
+  switch (format) {
+    case GL_RGBA16F:
+    case GL_RGBA32F:
+    case GL_R11F_G11F_B10F: return GL_FLOAT;
+    default: return GL_UNSIGNED_BYTE;
+  }
+}
+
+int glFormatBytes(GLenum format) {
+  switch (format) {
+    case GL_R8: return 1;
+    case GL_RGBA16F: return 8;
+    case GL_RGBA32F: return 16;
+    default: return 4; // RGBA8, R11G11B10F and DEPTH24 (padded to 32 bits)
+  }
+}
+
+void glFrameBufferAccount(struct glFrameBuffer* framebuffer) {
+  framebufferStats.bytes -= framebuffer->bytes;
+
+  size_t pixel = framebuffer->ds ? glFormatBytes(GL_DEPTH_COMPONENT24) : 0;
+  for (int i = 0; i < framebuffer->rtcount; i++) pixel += glFormatBytes(framebuffer->formats[i]);
+  framebuffer->bytes = pixel * framebuffer->width * framebuffer->height;
+
+  framebufferStats.bytes += framebuffer->bytes;
+  if (framebufferStats.bytes > framebufferStats.peak) framebufferStats.peak = framebufferStats.bytes;
+}
+
+void glFrameBufferDump(FILE* out) {
+  fprintf(out, "[FBO] %d framebuffers, %.2f MB (peak %.2f MB)\n", framebufferStats.count, framebufferStats.bytes / 1e6,
+          framebufferStats.peak / 1e6);
+}
+
+int glFrameBufferCreate(struct glFrameBuffer* framebuffer, struct glFrameBufferDesc desc) {
+  GLuint fbo, depthRb = 0;
+  GLuint colorTex[MAX_RENDER_TARGETS];
+  GLenum drawBuffers[MAX_RENDER_TARGETS];
+
+  if (desc.rtcount < 1 || desc.rtcount > MAX_RENDER_TARGETS) {
+    fprintf(stderr, "[ERR] Framebuffer with %d render targets\n", desc.rtcount);
+    return 1;
+  }
 
   glGenFramebuffers(1, &fbo);
   glBindFramebuffer(GL_FRAMEBUFFER, fbo);
 
-  glGenTextures(1, &colorTex);
-  glBindTexture(GL_TEXTURE_2D, colorTex);
-  glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-  glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-  glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, colorTex, 0);
+  glGenTextures(desc.rtcount, colorTex);
+  for (int i = 0; i < desc.rtcount; i++) {
+    glBindTexture(GL_TEXTURE_2D, colorTex[i]);
+    glTexImage2D(GL_TEXTURE_2D, 0, desc.formats[i], desc.width, desc.height, 0, glFormatLayout(desc.formats[i]), glFormatType(desc.formats[i]), NULL);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+    glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+    glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0 + i, GL_TEXTURE_2D, colorTex[i], 0);
+    drawBuffers[i] = GL_COLOR_ATTACHMENT0 + i;
+  }
+  glDrawBuffers(desc.rtcount, drawBuffers);
 
-  glGenRenderbuffers(1, &depthRb);
-  glBindRenderbuffer(GL_RENDERBUFFER, depthRb);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
-  glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRb);
+  if (desc.depth) {
+    glGenRenderbuffers(1, &depthRb);
+    glBindRenderbuffer(GL_RENDERBUFFER, depthRb);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, desc.width, desc.height);
+    glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, depthRb);
+  }
 
   if (glCheckFramebufferStatus(GL_FRAMEBUFFER) != GL_FRAMEBUFFER_COMPLETE) {
     fprintf(stderr, "[ERR] Framebuffer incomplete\n");
     glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glDeleteFramebuffers(1, &fbo);
+    glDeleteTextures(desc.rtcount, colorTex);
+    glDeleteRenderbuffers(1, &depthRb);
     return 1;
   }
 
   glBindFramebuffer(GL_FRAMEBUFFER, 0);
 
+  memset(framebuffer, 0, sizeof(*framebuffer));
   framebuffer->fbo     = fbo;
-  framebuffer->rt[0]   = colorTex;
   framebuffer->ds      = depthRb;
-  framebuffer->rtcount = 1;
-  framebuffer->width   = width;
-  framebuffer->height  = height;
-
-  fprintf(stderr, "[OK] Framebuffer created: %dx%d\n", width, height);
+  framebuffer->rtcount = desc.rtcount;
+  framebuffer->width   = desc.width;
+  framebuffer->height  = desc.height;
+  memcpy(framebuffer->rt, colorTex, desc.rtcount * sizeof(GLuint));
+  memcpy(framebuffer->formats, desc.formats, desc.rtcount * sizeof(GLenum));
+
+  framebufferStats.count++;
+  glFrameBufferAccount(framebuffer);
+  fprintf(stderr, "[OK] Framebuffer created: %dx%d, %d targets%s (%.2f MB)\n", desc.width, desc.height, desc.rtcount,
+          depthRb ? " + depth" : "", framebuffer->bytes / 1e6);
   return 0;
 }
 int glFrameBufferResize(struct glFrameBuffer* framebuffer, int width, int height) {
   if (width == framebuffer->width && height == framebuffer->height) return 0;
 
   for (int i = 0; i < framebuffer->rtcount; i++) {
+    GLenum format = framebuffer->formats[i];
     glBindTexture(GL_TEXTURE_2D, framebuffer->rt[i]);
-    glTexImage2D(GL_TEXTURE_2D, 0, GL_RGBA8, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+    glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, glFormatLayout(format), glFormatType(format), NULL);
+  }
+  if (framebuffer->ds) {
+    glBindRenderbuffer(GL_RENDERBUFFER, framebuffer->ds);
+    glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
   }
-  glBindRenderbuffer(GL_RENDERBUFFER, framebuffer->ds);
-  glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, width, height);
 
   framebuffer->width  = width;
   framebuffer->height = height;
+  glFrameBufferAccount(framebuffer);
 
   glBindTexture(GL_TEXTURE_2D, 0);
   glBindRenderbuffer(GL_RENDERBUFFER, 0);
-  fprintf(stderr, "[OK] Framebuffer resized: %dx%d\n", width, height);
+  fprintf(stderr, "[OK] Framebuffer resized: %dx%d (%.2f MB)\n", width, height, framebuffer->bytes / 1e6);
   return 0;
 }
 
 int glFrameBufferDispose(struct glFrameBuffer* framebuffer) {
   glDeleteFramebuffers(1, &framebuffer->fbo);
   glDeleteTextures(framebuffer->rtcount, framebuffer->rt);
-  glDeleteRenderbuffers(1, &framebuffer->ds);
+  if (framebuffer->ds) glDeleteRenderbuffers(1, &framebuffer->ds);
+
+  framebufferStats.count--;
+  framebufferStats.bytes -= framebuffer->bytes;
+  framebuffer->bytes = 0;
+  return 0;
+}
+
+//=================================================[RENDER TARGET POOL]========================================================
+
+//Transient render targets are acquired for the part of a frame they are needed and released afterwards, a later
+//acquire with the same size and layout reuses the released target, so passes whose lifetimes don't overlap share
+//memory and size changes no longer reallocate storage. Targets unused for POOL_EVICT_FRAMES are freed, and the least
+//recently used free targets as soon as the pool grows over its memory budget.
+struct PooledTarget {
+  struct glFrameBuffer framebuffer; // fbo is 0 for an empty slot
+  int                  inUse;
+  long long            lastUsed; // Pool frame of the last acquire
+};
+
+struct RenderTargetPool {
+  struct PooledTarget targets[MAX_POOLED_TARGETS];
+  long long           frame;
+  long long           bytes;
+  long long           peak;
+  long long           budget; // Free targets are evicted while bytes is over it, 0 for no limit
+  int                 hits;
+  int                 misses;
+  int                 evictions;
+} renderTargetPool;
+
+int renderTargetMatches(struct glFrameBuffer* framebuffer, struct glFrameBufferDesc* desc) {
+  if (framebuffer->width != desc->width || framebuffer->height != desc->height || framebuffer->rtcount != desc->rtcount ||
+      (framebuffer->ds != 0) != (desc->depth != 0))
+    return 0;
+  return memcmp(framebuffer->formats, desc->formats, desc->rtcount * sizeof(GLenum)) == 0;
+}
+
+void renderTargetEvict(struct RenderTargetPool* pool, struct PooledTarget* target) {
+  pool->bytes -= target->framebuffer.bytes;
+  pool->evictions++;
+  glFrameBufferDispose(&target->framebuffer);
+  memset(target, 0, sizeof(*target));
+}
+
+//Frees the least recently used free targets while the pool is over its budget, targets in use are never freed
+void renderTargetPoolTrim(struct RenderTargetPool* pool) {
+  while (pool->budget > 0 && pool->bytes > pool->budget) {
+    struct PooledTarget* oldest = NULL;
+    for (int i = 0; i < MAX_POOLED_TARGETS; i++) {
+      struct PooledTarget* target = &pool->targets[i];
+      if (target->framebuffer.fbo && !target->inUse && (!oldest || target->lastUsed < oldest->lastUsed)) oldest = target;
+    }
+    if (!oldest) return;
+    renderTargetEvict(pool, oldest);
+  }
+}
+
+struct glFrameBuffer* renderTargetAcquire(struct RenderTargetPool* pool, struct glFrameBufferDesc desc) {
+  struct PooledTarget* slot = NULL;
+  for (int i = 0; i < MAX_POOLED_TARGETS; i++) {
+    struct PooledTarget* target = &pool->targets[i];
+    if (target->framebuffer.fbo && !target->inUse && renderTargetMatches(&target->framebuffer, &desc)) {
+      target->inUse    = 1;
+      target->lastUsed = pool->frame;
+      pool->hits++;
+      return &target->framebuffer;
+    }
+    if (!slot && !target->framebuffer.fbo) slot = target;
+  }
+  int empty = slot != NULL;
+
+  // Pool full, reuse the slot of the least recently used free target
+  for (int i = 0; i < MAX_POOLED_TARGETS && !empty; i++) {
+    struct PooledTarget* target = &pool->targets[i];
+    if (!target->inUse && (!slot || target->lastUsed < slot->lastUsed)) slot = target;
+  }
+  if (!slot) {
+    fprintf(stderr, "[ERR] Render target pool exhausted\n");
+    return NULL;
+  }
+  if (slot->framebuffer.fbo) renderTargetEvict(pool, slot);
+
+  if (glFrameBufferCreate(&slot->framebuffer, desc)) return NULL;
+  slot->inUse    = 1;
+  slot->lastUsed = pool->frame;
+  pool->misses++;
+  pool->bytes += slot->framebuffer.bytes;
+  if (pool->bytes > pool->peak) pool->peak = pool->bytes;
+  renderTargetPoolTrim(pool);
+  return &slot->framebuffer;
+}
+
+void renderTargetRelease(struct RenderTargetPool* pool, struct glFrameBuffer* framebuffer) {
+  if (!framebuffer) return;
+  struct PooledTarget* target = (struct PooledTarget*)((char*)framebuffer - offsetof(struct PooledTarget, framebuffer));
+  target->inUse               = 0;
+  target->lastUsed            = pool->frame; // Held across frames (session FBO, loop bake) counts as used until released
+}
+
+//Advances the pool frame, freeing targets nobody acquired for a while
+void renderTargetPoolFrame(struct RenderTargetPool* pool) {
+  pool->frame++;
+  for (int i = 0; i < MAX_POOLED_TARGETS; i++) {
+    struct PooledTarget* target = &pool->targets[i];
+    if (target->framebuffer.fbo && !target->inUse && pool->frame - target->lastUsed > POOL_EVICT_FRAMES)
+      renderTargetEvict(pool, target);
+  }
+}
+
+void renderTargetPoolDump(struct RenderTargetPool* pool, FILE* out) {
+  int count = 0, inUse = 0;
+  for (int i = 0; i < MAX_POOLED_TARGETS; i++) {
+    count += pool->targets[i].framebuffer.fbo != 0;
+    inUse += pool->targets[i].inUse;
+  }
+  fprintf(out, "[POOL] %d render targets (%d in use), %.2f MB (peak %.2f MB, budget %.0f MB), %d hits, %d misses, %d evicted\n", count,
+          inUse, pool->bytes / 1e6, pool->peak / 1e6, pool->budget / 1e6, pool->hits, pool->misses, pool->evictions);
+}
+
+void renderTargetPoolDispose(struct RenderTargetPool* pool) {
+  for (int i = 0; i < MAX_POOLED_TARGETS; i++)
+    if (pool->targets[i].framebuffer.fbo) glFrameBufferDispose(&pool->targets[i].framebuffer);
+  memset(pool, 0, sizeof(*pool));
+}
+
+//====================================================[UPSCALER]============================================================
+
+enum UpscalerKind {
+  UPSCALER_BILINEAR = 0,
+  UPSCALER_BICUBIC,
+  UPSCALER_SHARPEN,
+  UPSCALER_COUNT
+};
+
+const char* upscalerNames[UPSCALER_COUNT] = {"bilinear", "bicubic", "sharpen"};
+
+enum UpscalerKind getUpscalerKind(const char* name) {
+  if (name == 0) return UPSCALER_BILINEAR;
+  for (int i = 0; i < UPSCALER_COUNT; i++)
+    if (strcmp(name, upscalerNames[i]) == 0) return i;
+  fprintf(stderr, "Unknown upscaler %s, using bilinear\n", name);
+  return UPSCALER_BILINEAR;
+}
+
+const char* resampleFilterNames[] = {"none", "box", "lanczos"};
+
+enum ResampleFilter getResampleFilter(const char* name) {
+  if (name == 0) return RESAMPLE_NONE;
+  for (int i = 0; i <= RESAMPLE_LANCZOS; i++)
+    if (strcmp(name, resampleFilterNames[i]) == 0) return i;
+  if (strcmp(name, "1") == 0) return RESAMPLE_LANCZOS;
+  if (strcmp(name, "0") != 0) fprintf(stderr, "Unknown texture filter %s, textures are not downscaled\n", name);
+  return RESAMPLE_NONE;
+}
+
+const char* upscaleVertexSource =
+  "#version 330 core\n"
+  "layout(location = 0) in vec2 aPosition;\n"
+  "out vec2 fUV;\n"
+  "void main() {\n"
+  "  gl_Position = vec4(aPosition, 0.0, 1.0);\n"
+  "  fUV = aPosition * 0.5 + 0.5;\n"
+  "}\n";
+
+// Catmull-Rom in 9 bilinear taps, clamped to the 2x2 source neighbourhood to remove ringing around edges
+const char* upscaleBicubicSource =
+  "#version 330 core\n"
+  "uniform sampler2D iSource;\n"
+  "uniform vec2 iSourceSize;\n"
+  "in vec2 fUV;\n"
+  "out vec4 color;\n"
+  "void main() {\n"
+  "  vec2 samplePos = fUV * iSourceSize;\n"
+  "  vec2 texPos1 = floor(samplePos - 0.5) + 0.5;\n"
+  "  vec2 f = samplePos - texPos1;\n"
+  "  vec2 w0 = f * (-0.5 + f * (1.0 - 0.5 * f));\n"
+  "  vec2 w1 = 1.0 + f * f * (-2.5 + 1.5 * f);\n"
+  "  vec2 w2 = f * (0.5 + f * (2.0 - 1.5 * f));\n"
+  "  vec2 w3 = f * f * (-0.5 + 0.5 * f);\n"
+  "  vec2 w12 = w1 + w2;\n"
+  "  vec2 offset12 = w2 / w12;\n"
+  "  vec2 texPos0 = (texPos1 - 1.0) / iSourceSize;\n"
+  "  vec2 texPos3 = (texPos1 + 2.0) / iSourceSize;\n"
+  "  vec2 texPos12 = (texPos1 + offset12) / iSourceSize;\n"
+  "  vec4 result = vec4(0.0);\n"
+  "  result += texture(iSource, vec2(texPos0.x, texPos0.y)) * w0.x * w0.y;\n"
+  "  result += texture(iSource, vec2(texPos12.x, texPos0.y)) * w12.x * w0.y;\n"
+  "  result += texture(iSource, vec2(texPos3.x, texPos0.y)) * w3.x * w0.y;\n"
+  "  result += texture(iSource, vec2(texPos0.x, texPos12.y)) * w0.x * w12.y;\n"
+  "  result += texture(iSource, vec2(texPos12.x, texPos12.y)) * w12.x * w12.y;\n"
+  "  result += texture(iSource, vec2(texPos3.x, texPos12.y)) * w3.x * w12.y;\n"
+  "  result += texture(iSource, vec2(texPos0.x, texPos3.y)) * w0.x * w3.y;\n"
+  "  result += texture(iSource, vec2(texPos12.x, texPos3.y)) * w12.x * w3.y;\n"
+  "  result += texture(iSource, vec2(texPos3.x, texPos3.y)) * w3.x * w3.y;\n"
+  "  ivec2 p = clamp(ivec2(texPos1 - 0.5), ivec2(0), ivec2(iSourceSize) - 2);\n"
+  "  vec4 a = texelFetch(iSource, p, 0);\n"
+  "  vec4 b = texelFetch(iSource, p + ivec2(1, 0), 0);\n"
+  "  vec4 c = texelFetch(iSource, p + ivec2(0, 1), 0);\n"
+  "  vec4 d = texelFetch(iSource, p + ivec2(1, 1), 0);\n"
+  "  color = clamp(result, min(min(a, b), min(c, d)), max(max(a, b), max(c, d)));\n"
+  "}\n";
+
+// Robust contrast adaptive sharpening (FSR1 RCAS) at output resolution
+const char* upscaleSharpenSource =
+  "#version 330 core\n"
+  "uniform sampler2D iSource;\n"
+  "uniform float iSharpness;\n"
+  "out vec4 color;\n"
+  "vec3 fetch(ivec2 p) {\n"
+  "  return texelFetch(iSource, clamp(p, ivec2(0), textureSize(iSource, 0) - 1), 0).rgb;\n"
+  "}\n"
+  "void main() {\n"
+  "  ivec2 p = ivec2(gl_FragCoord.xy);\n"
+  "  vec3 b = fetch(p + ivec2(0, -1));\n"
+  "  vec3 d = fetch(p + ivec2(-1, 0));\n"
+  "  vec3 e = fetch(p);\n"
+  "  vec3 f = fetch(p + ivec2(1, 0));\n"
+  "  vec3 h = fetch(p + ivec2(0, 1));\n"
+  "  vec3 mn4 = min(min(b, d), min(f, h));\n"
+  "  vec3 mx4 = max(max(b, d), max(f, h));\n"
+  "  vec3 hitMin = min(mn4, e) / (4.0 * max(mx4, e) + 1e-5);\n"
+  "  vec3 hitMax = (1.0 - max(mx4, e)) / (4.0 * min(mn4, e) - 4.0 - 1e-5);\n"
+  "  vec3 lobeRGB = max(-hitMin, hitMax);\n"
+  "  float lobe = max(-0.1875, min(max(lobeRGB.r, max(lobeRGB.g, lobeRGB.b)), 0.0)) * iSharpness;\n"
+  "  color = vec4((lobe * (b + d + f + h) + e) / (4.0 * lobe + 1.0), 1.0);\n"
+  "}\n";
+
+struct Upscaler {
+  GLuint bicubicProgram;
+  GLuint sharpenProgram; // Runs on a pooled output resolution target written by the bicubic pass
+};
+
+int upscalerCreate(struct Upscaler* upscaler) {
+  memset(upscaler, 0, sizeof(*upscaler));
+  upscaler->bicubicProgram = glProgramCompileSource(upscaleBicubicSource, upscaleVertexSource, "upscale bicubic");
+  upscaler->sharpenProgram = glProgramCompileSource(upscaleSharpenSource, upscaleVertexSource, "upscale sharpen");
+  return !upscaler->bicubicProgram || !upscaler->sharpenProgram;
+}
+
+void upscalerDispose(struct Upscaler* upscaler) {
+  glDeleteProgram(upscaler->bicubicProgram);
+  glDeleteProgram(upscaler->sharpenProgram);
+}
+
+void upscalerPass(GLuint program, GLuint source, int sourceWidth, int sourceHeight, GLuint target, int width, int height, GLuint vao) {
+  glBindFramebuffer(GL_FRAMEBUFFER, target);
+  glViewport(0, 0, width, height);
+  glUseProgram(program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, source);
+  glUniform1i(glGetUniformLocation(program, "iSource"), 0);
+  glUniform2f(glGetUniformLocation(program, "iSourceSize"), sourceWidth, sourceHeight);
+  glBindVertexArray(vao);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+//Scales the color target of source up to the default framebuffer
+void upscalerApply(struct Upscaler* upscaler, enum UpscalerKind kind, struct glFrameBuffer* source, int width, int height, float sharpness, GLuint vao) {
+  if (kind == UPSCALER_BICUBIC && upscaler->bicubicProgram) {
+    upscalerPass(upscaler->bicubicProgram, source->rt[0], source->width, source->height, 0, width, height, vao);
+  } else if (kind == UPSCALER_SHARPEN && upscaler->bicubicProgram && upscaler->sharpenProgram) {
+    struct glFrameBuffer* intermediate = renderTargetAcquire(&renderTargetPool, glFrameBufferColor(width, height, GL_RGBA8));
+    if (intermediate) {
+      upscalerPass(upscaler->bicubicProgram, source->rt[0], source->width, source->height, intermediate->fbo, width, height, vao);
+
+      glUseProgram(upscaler->sharpenProgram);
+      glUniform1f(glGetUniformLocation(upscaler->sharpenProgram, "iSharpness"), sharpness);
+      upscalerPass(upscaler->sharpenProgram, intermediate->rt[0], width, height, 0, width, height, vao);
+      renderTargetRelease(&renderTargetPool, intermediate);
+    }
+  } else {
+    glBindFramebuffer(GL_READ_FRAMEBUFFER, source->fbo);
+    glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+
+    glBlitFramebuffer(
+      0, 0, source->width, source->height,
+      0, 0, width, height,
+      GL_COLOR_BUFFER_BIT,
+      GL_LINEAR);
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+}
+
+//====================================================[INTERLEAVE]==========================================================
+
+// Every frame only the pixels whose index in the interleave pattern matches the phase are shaded.
+// Factor 2 is a checkerboard, factor 4 shades one pixel of every 2x2 quad.
+const char* interleaveIndexSource =
+  "int interleaveIndex(ivec2 p, int factor) {\n"
+  "  return factor == 2 ? ((p.x + p.y) & 1) : ((p.x & 1) + 2 * (p.y & 1));\n"
+  "}\n";
+
+const char* interleaveMaskVertexSource =
+  "#version 330 core\n"
+  "layout(location = 0) in vec2 aPosition;\n"
+  "void main() {\n"
+  "  gl_Position = vec4(aPosition, -1.0, 1.0);\n"
+  "}\n";
+
+// Writes depth 0 on the pixels skipped this frame so the early depth test rejects them
+const char* interleaveMaskSource =
+  "#version 330 core\n"
+  "uniform int iFactor;\n"
+  "uniform int iPhase;\n"
+  "%s"
+  "void main() {\n"
+  "  if (interleaveIndex(ivec2(gl_FragCoord.xy), iFactor) == iPhase) discard;\n"
+  "}\n";
+
+// Takes freshly shaded pixels as they are and fills the rest from history, clamped to the range
+// of the fresh neighbours so moving content does not leave trails
+const char* interleaveResolveSource =
+  "#version 330 core\n"
+  "uniform sampler2D iCurrent;\n"
+  "uniform sampler2D iHistory;\n"
+  "uniform int iFactor;\n"
+  "uniform int iPhase;\n"
+  "uniform int iHasHistory;\n"
+  "out vec4 color;\n"
+  "%s"
+  "void main() {\n"
+  "  ivec2 p = ivec2(gl_FragCoord.xy);\n"
+  "  ivec2 size = textureSize(iCurrent, 0);\n"
+  "  if (interleaveIndex(p, iFactor) == iPhase) {\n"
+  "    color = texelFetch(iCurrent, p, 0);\n"
+  "    return;\n"
+  "  }\n"
+  "  vec4 mn = vec4(1e9), mx = vec4(-1e9), sum = vec4(0.0);\n"
+  "  float count = 0.0;\n"
+  "  for (int y = -1; y <= 1; y++)\n"
+  "    for (int x = -1; x <= 1; x++) {\n"
+  "      ivec2 q = p + ivec2(x, y);\n"
+  "      if (any(lessThan(q, ivec2(0))) || any(greaterThanEqual(q, size)) || interleaveIndex(q, iFactor) != iPhase) continue;\n"
+  "      vec4 c = texelFetch(iCurrent, q, 0);\n"
+  "      mn = min(mn, c);\n"
+  "      mx = max(mx, c);\n"
+  "      sum += c;\n"
+  "      count += 1.0;\n"
+  "    }\n"
+  "  vec4 average = count > 0.0 ? sum / count : texelFetch(iCurrent, p, 0);\n"
+  "  color = iHasHistory != 0 && count > 0.0 ? clamp(texelFetch(iHistory, p, 0), mn, mx) : average;\n"
+  "}\n";
+
+struct InterleaveState {
+  int                  factor; // 1 disables interleaving, 2 or 4 shades 1/factor of the pixels per frame
+  int                  phase;
+  int                  current; // History target written this frame
+  int                  hasHistory;
+  struct glFrameBuffer history[2];
+  GLuint               maskProgram;
+  GLuint               resolveProgram;
+  long long            skippedPixels; // Pixels not shaded in the last frame
+  long long            skippedTotal;
+};
+
+int interleaveCreate(struct InterleaveState* interleave, int factor) {
+  memset(interleave, 0, sizeof(*interleave));
+  interleave->factor = factor == 2 || factor == 4 ? factor : 1;
+  if (interleave->factor == 1) return 0;
+
+  char source[4096];
+  snprintf(source, sizeof(source), interleaveMaskSource, interleaveIndexSource);
+  interleave->maskProgram = glProgramCompileSource(source, interleaveMaskVertexSource, "interleave mask");
+  snprintf(source, sizeof(source), interleaveResolveSource, interleaveIndexSource);
+  interleave->resolveProgram = glProgramCompileSource(source, upscaleVertexSource, "interleave resolve");
+
+  if (!interleave->maskProgram || !interleave->resolveProgram ||
+      glFrameBufferCreate(&interleave->history[0], glFrameBufferColor(720, 640, GL_RGBA8)) ||
+      glFrameBufferCreate(&interleave->history[1], glFrameBufferColor(720, 640, GL_RGBA8))) {
+    fprintf(stderr, "[ERR] Interleaved rendering unavailable\n");
+    interleave->factor = 1;
+    return 1;
+  }
   return 0;
 }
 
+void interleaveDispose(struct InterleaveState* interleave) {
+  if (!interleave->maskProgram) return;
+  glDeleteProgram(interleave->maskProgram);
+  glDeleteProgram(interleave->resolveProgram);
+  glFrameBufferDispose(&interleave->history[0]);
+  glFrameBufferDispose(&interleave->history[1]);
+}
+
+//Expects the target framebuffer bound with depth cleared to 1. Leaves the depth test enabled for the shader draw.
+void interleaveBeginMask(struct InterleaveState* interleave, int width, int height, GLuint vao) {
+  interleave->phase = (interleave->phase + 1) % interleave->factor;
+
+  glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+  glEnable(GL_DEPTH_TEST);
+  glDepthFunc(GL_ALWAYS);
+  glDepthMask(GL_TRUE);
+
+  glUseProgram(interleave->maskProgram);
+  glUniform1i(glGetUniformLocation(interleave->maskProgram, "iFactor"), interleave->factor);
+  glUniform1i(glGetUniformLocation(interleave->maskProgram, "iPhase"), interleave->phase);
+  glBindVertexArray(vao);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+
+  glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+  glDepthFunc(GL_LESS);
+  glDepthMask(GL_FALSE);
+
+  interleave->skippedPixels = (long long)width * height * (interleave->factor - 1) / interleave->factor;
+  interleave->skippedTotal += interleave->skippedPixels;
+}
+
+//Reconstructs the full frame into the next history target and returns it
+struct glFrameBuffer* interleaveResolve(struct InterleaveState* interleave, struct glFrameBuffer* current, GLuint vao) {
+  glDisable(GL_DEPTH_TEST);
+  glDepthMask(GL_TRUE);
+
+  int previous        = interleave->current;
+  interleave->current = !previous;
+
+  struct glFrameBuffer* target = &interleave->history[interleave->current];
+
+  if (interleave->history[0].width != current->width || interleave->history[0].height != current->height)
+    interleave->hasHistory = 0;
+  glFrameBufferResize(&interleave->history[0], current->width, current->height);
+  glFrameBufferResize(&interleave->history[1], current->width, current->height);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+  glViewport(0, 0, target->width, target->height);
+  glUseProgram(interleave->resolveProgram);
+
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D, current->rt[0]);
+  glActiveTexture(GL_TEXTURE1);
+  glBindTexture(GL_TEXTURE_2D, interleave->history[previous].rt[0]);
+
+  glUniform1i(glGetUniformLocation(interleave->resolveProgram, "iCurrent"), 0);
+  glUniform1i(glGetUniformLocation(interleave->resolveProgram, "iHistory"), 1);
+  glUniform1i(glGetUniformLocation(interleave->resolveProgram, "iFactor"), interleave->factor);
+  glUniform1i(glGetUniformLocation(interleave->resolveProgram, "iPhase"), interleave->phase);
+  glUniform1i(glGetUniformLocation(interleave->resolveProgram, "iHasHistory"), interleave->hasHistory);
+
+  glBindVertexArray(vao);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+  glActiveTexture(GL_TEXTURE0);
+
+  interleave->hasHistory = 1;
+  return target;
+}
+
 //=========================[CONFIG PARSER LIB]===================================================
 
 
@@ -566,22 +2406,107 @@ enum ShaderMode getShaderMode(const char* sessionmode) {
 
 //===========================[CONFIG]===================================================================
 
+//A [pass/A]..[pass/D] buffer pass or the [pass/image] pass drawing the configured fragment shader
+struct PassConfiguration {
+  int    enabled;
+  char   fragmentShader[MAX_LINE_LENGTH];
+  char   channel[MAX_CHANNELS][MAX_LINE_LENGTH]; // Buffer name A-D or a texture path, empty when unused
+  float  scale;                                  // Fraction of the screen resolution
+  GLenum format;
+};
+
+const char* renderPassNames[RENDER_PASS_COUNT] = {"A", "B", "C", "D", "image"};
+
+GLenum getPassFormat(const char* format) {
+  if (format == 0) return GL_RGBA8;
+  if (strcmp(format, "rgba16f") == 0) return GL_RGBA16F;
+  if (strcmp(format, "rgba32f") == 0) return GL_RGBA32F;
+  if (strcmp(format, "r11g11b10f") == 0) return GL_R11F_G11F_B10F;
+  if (strcmp(format, "r8") == 0) return GL_R8;
+  return GL_RGBA8;
+}
+
 struct SessionConfiguration {
-  enum ShaderMode mode;
-  int             upscalingFactor;
-  char            vertexShader[MAX_LINE_LENGTH];
-  char            fragmentShader[MAX_LINE_LENGTH];
-  char            texturePath[MAX_TEXTURE_SLOTS][MAX_LINE_LENGTH];
-  int             textureCount;
+  enum ShaderMode          mode;
+  float                    renderScale; // Fraction of the screen resolution rendered, upscaled afterwards
+  int                      upscaler;
+  float                    sharpness;
+  int                      interleave;
+  int                      tiles;
+  float                    sliceBudget;
+  float                    loopPeriod;
+  int                      loopFps;
+  int                      loopBudget;
+  int                      loopCacheSize; // MB of baked loops kept on disk
+  int                      poolBudget; // MB of render targets the pool keeps
+  int                      textureCacheSize; // MB of decoded textures cached on disk
+  int                      targetFps;
+  int                      vsync;
+  float                    frameBudget;
+  float                    minScale;
+  float                    maxScale;
+  char                     vertexShader[MAX_LINE_LENGTH];
+  char                     fragmentShader[MAX_LINE_LENGTH];
+  char                     texturePath[MAX_TEXTURE_SLOTS][MAX_LINE_LENGTH];
+  int                      textureCount;
+  char                     defines[MAX_DEFINES_LENGTH]; // #define lines injected in every shader of the program
+  int                      freeze;                      // Freeze user uniforms into constants once they stop changing
+  int                      textureArray;                // Pack user textures into iUserTextureArray instead of iUserTextures
+  enum ResampleFilter      textureFilter;               // Downscales user textures to the display size when set
+  int                      uniformCount;                // Initial user uniform values from [shadermode/uniforms]
+  char                     uniformName[MAX_HINT_UNIFORMS][MAX_UNIFORM_NAME_LENGTH];
+  char                     uniformValue[MAX_HINT_UNIFORMS][MAX_LINE_LENGTH];
+  struct PassConfiguration passes[RENDER_PASS_COUNT];
+  int                      tierCount; // Reduced quality variants below the base program
+  char                     tierDefines[MAX_QUALITY_TIERS][MAX_DEFINES_LENGTH];
 };
 
 void sessionConfigurationPrint(struct SessionConfiguration* configuration) {
   printf("mode: %d\n", configuration->mode);
   printf("vertexshader: %s\n", configuration->vertexShader);
   printf("fragmentshader: %s\n", configuration->fragmentShader);
+  printf("targetfps: %d\n", configuration->targetFps);
+  printf("vsync: %d\n", configuration->vsync);
+  printf("renderscale: %.2f (%s)\n", configuration->renderScale, upscalerNames[configuration->upscaler]);
+  printf("interleave: %d\n", configuration->interleave);
+  printf("tiles: %d (slice budget %.2fms)\n", configuration->tiles, configuration->sliceBudget);
+  printf("loopperiod: %.2f (%d fps, %d MB)\n", configuration->loopPeriod, configuration->loopFps, configuration->loopBudget);
+  printf("loopcachemb: %d\n", configuration->loopCacheSize);
+  printf("poolmb: %d\n", configuration->poolBudget);
+  printf("texturecachemb: %d\n", configuration->textureCacheSize);
+  printf("downscaletextures: %s\n", resampleFilterNames[configuration->textureFilter]);
+  printf("texturearray: %d\n", configuration->textureArray);
+  for (int i = 0; i < RENDER_PASS_COUNT; i++) {
+    struct PassConfiguration* pass = &configuration->passes[i];
+    if (pass->enabled)
+      printf("pass %s: %s scale %.2f channels [%s] [%s] [%s] [%s]\n", renderPassNames[i], pass->fragmentShader, pass->scale,
+             pass->channel[0], pass->channel[1], pass->channel[2], pass->channel[3]);
+  }
+  printf("defines:\n%s", configuration->defines);
+  for (int i = 0; i < configuration->tierCount; i++) printf("tier%d:\n%s", i, configuration->tierDefines[i]);
+  printf("framebudget: %.2f (scale %.2f-%.2f)\n", configuration->frameBudget, configuration->minScale, configuration->maxScale);
   printf("\n");
 }
 
+//Writes the #define block of [shadermode/defines] overridden by tier, returns the number of keys in tier
+int sessionConfigurationDefines(struct ParseContext* ctx, const char* tier, char* dst) {
+  const char* keys[MAX_HINT_UNIFORMS];
+  int         count  = parseContextGetKeys(ctx, "shadermode/defines", keys, MAX_HINT_UNIFORMS);
+  size_t      length = 0;
+  dst[0]             = 0;
+
+  for (int i = 0; i < count && length < MAX_DEFINES_LENGTH; i++) {
+    if (tier && parseContextGetValue(ctx, tier, keys[i])) continue;
+    length += snprintf(dst + length, MAX_DEFINES_LENGTH - length, "#define %s %s\n", keys[i], parseContextGetValue(ctx, "shadermode/defines", keys[i]));
+  }
+  if (!tier) return count;
+
+  count = parseContextGetKeys(ctx, tier, keys, MAX_HINT_UNIFORMS);
+  for (int i = 0; i < count && length < MAX_DEFINES_LENGTH; i++)
+    length += snprintf(dst + length, MAX_DEFINES_LENGTH - length, "#define %s %s\n", keys[i], parseContextGetValue(ctx, tier, keys[i]));
+  return count;
+}
+
 int sessionConfigurationParse(struct SessionConfiguration* configuration, const char* path) {
   void* fdata = fileRead(path);
   if (fdata == 0) {
@@ -592,8 +2517,56 @@ int sessionConfigurationParse(struct SessionConfiguration* configuration, const
   struct ParseContext* ctx = parseContextCreate(fdata);
 
   configuration->mode            = getShaderMode(parseContextGetValue(ctx, "general", "shadermode"));
-  configuration->upscalingFactor = 1;
+  configuration->renderScale     = 1.0f;
   configuration->textureCount    = 0;
+  configuration->targetFps       = DEFAULT_TARGET_FPS;
+  configuration->vsync           = 0;
+
+  const char* targetFps = parseContextGetValue(ctx, "general", "targetfps");
+  const char* vsync     = parseContextGetValue(ctx, "general", "vsync");
+  if (targetFps) configuration->targetFps = atoi(targetFps);
+  if (vsync) configuration->vsync = atoi(vsync);
+  if (configuration->targetFps < 0) configuration->targetFps = 0;
+
+  const char* renderScale = parseContextGetValue(ctx, "general", "renderscale");
+  const char* sharpness   = parseContextGetValue(ctx, "general", "sharpness");
+  configuration->upscaler    = getUpscalerKind(parseContextGetValue(ctx, "general", "upscaler"));
+  configuration->sharpness   = sharpness ? atof(sharpness) : 0.8f;
+  if (configuration->sharpness < 0.0f) configuration->sharpness = 0.0f;
+  if (configuration->sharpness > 1.0f) configuration->sharpness = 1.0f;
+
+  const char* interleave    = parseContextGetValue(ctx, "general", "interleave");
+  configuration->interleave = interleave ? atoi(interleave) : 1;
+
+  const char* tiles          = parseContextGetValue(ctx, "general", "tiles");
+  const char* sliceBudget    = parseContextGetValue(ctx, "general", "slicebudget");
+  configuration->tiles       = tiles ? atoi(tiles) : 1;
+  configuration->sliceBudget = sliceBudget ? atof(sliceBudget) : DEFAULT_SLICE_BUDGET;
+
+  const char* loopPeriod       = parseContextGetValue(ctx, "general", "loopperiod");
+  const char* loopFps          = parseContextGetValue(ctx, "general", "loopfps");
+  const char* loopBudget       = parseContextGetValue(ctx, "general", "loopbudget");
+  const char* loopCacheSize    = parseContextGetValue(ctx, "general", "loopcachemb");
+  configuration->loopPeriod    = loopPeriod ? atof(loopPeriod) : 0.0f;
+  configuration->loopFps       = loopFps ? atoi(loopFps) : DEFAULT_LOOP_FPS;
+  configuration->loopBudget    = loopBudget ? atoi(loopBudget) : DEFAULT_LOOP_BUDGET;
+  configuration->loopCacheSize = loopCacheSize ? atoi(loopCacheSize) : LOOP_CACHE_MB;
+
+  const char* poolBudget          = parseContextGetValue(ctx, "general", "poolmb");
+  const char* textureCacheSize    = parseContextGetValue(ctx, "general", "texturecachemb");
+  configuration->poolBudget       = poolBudget ? atoi(poolBudget) : POOL_BUDGET_MB;
+  configuration->textureCacheSize = textureCacheSize ? atoi(textureCacheSize) : TEXTURE_CACHE_MB;
+  if (renderScale) configuration->renderScale = atof(renderScale);
+  if (configuration->renderScale <= 0.0f || configuration->renderScale > 1.0f) configuration->renderScale = 1.0f;
+
+  const char* frameBudget = parseContextGetValue(ctx, "general", "framebudget");
+  const char* minScale    = parseContextGetValue(ctx, "general", "minscale");
+  const char* maxScale    = parseContextGetValue(ctx, "general", "maxscale");
+  configuration->frameBudget = frameBudget ? atof(frameBudget) : 0.0f;
+  configuration->minScale    = minScale ? atof(minScale) : 0.25f;
+  configuration->maxScale    = maxScale ? atof(maxScale) : 1.0f;
+  if (configuration->maxScale > 1.0f || configuration->maxScale <= 0.0f) configuration->maxScale = 1.0f;
+  if (configuration->minScale > configuration->maxScale || configuration->minScale <= 0.0f) configuration->minScale = configuration->maxScale;
 
   if (configuration->mode == SHADER_MODE_SHADER) {
     strndump(configuration->fragmentShader, parseContextGetValue(ctx, "shadermode/shader", "fragmentshader"), MAX_LINE_LENGTH);
@@ -611,12 +2584,61 @@ int sessionConfigurationParse(struct SessionConfiguration* configuration, const
     }
   }
 
-  parseContextDispose(ctx);
-  free(fdata);
-  sessionConfigurationPrint(configuration);
-  return 0;
-}
-
+  sessionConfigurationDefines(ctx, NULL, configuration->defines);
+
+  for (int i = 0; i < RENDER_PASS_COUNT; i++) {
+    struct PassConfiguration* pass = &configuration->passes[i];
+    char                      section[MAX_LINE_LENGTH];
+    snprintf(section, sizeof(section), "pass/%s", renderPassNames[i]);
+
+    const char* fragmentShader = parseContextGetValue(ctx, section, "fragmentshader");
+    const char* scale          = parseContextGetValue(ctx, section, "scale");
+    const char* keys[1];
+    pass->enabled = parseContextGetKeys(ctx, section, keys, 1) > 0 && (fragmentShader || i == RENDER_PASS_IMAGE);
+    pass->scale   = scale ? atof(scale) : 1.0f;
+    pass->format  = getPassFormat(parseContextGetValue(ctx, section, "format"));
+    if (pass->scale <= 0.0f || pass->scale > 1.0f) pass->scale = 1.0f;
+    strndump(pass->fragmentShader, fragmentShader, MAX_LINE_LENGTH);
+
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      char key[16];
+      snprintf(key, sizeof(key), "iChannel%d", c);
+      strndump(pass->channel[c], parseContextGetValue(ctx, section, key), MAX_LINE_LENGTH);
+    }
+  }
+
+  const char* freeze    = parseContextGetValue(ctx, "general", "freeze");
+  configuration->freeze = freeze ? atoi(freeze) : 0;
+
+  configuration->textureFilter = getResampleFilter(parseContextGetValue(ctx, "general", "downscaletextures"));
+
+  const char* textureArray    = parseContextGetValue(ctx, "general", "texturearray");
+  configuration->textureArray = textureArray ? atoi(textureArray) : 0;
+
+  const char* uniforms[MAX_HINT_UNIFORMS];
+  int         uniformCount    = parseContextGetKeys(ctx, "shadermode/uniforms", uniforms, MAX_HINT_UNIFORMS);
+  configuration->uniformCount = 0;
+  for (int i = 0; i < uniformCount; i++) {
+    if (strncmp(uniforms[i], "iUserTextures", 13) == 0) continue;
+    strndump(configuration->uniformName[configuration->uniformCount], uniforms[i], MAX_UNIFORM_NAME_LENGTH);
+    strndump(configuration->uniformValue[configuration->uniformCount], parseContextGetValue(ctx, "shadermode/uniforms", uniforms[i]), MAX_LINE_LENGTH);
+    configuration->uniformCount++;
+  }
+
+  configuration->tierCount = 0;
+  for (int i = 0; i < MAX_QUALITY_TIERS; i++) {
+    char section[MAX_LINE_LENGTH];
+    snprintf(section, sizeof(section), "shadermode/tier%d", i);
+    if (!sessionConfigurationDefines(ctx, section, configuration->tierDefines[i])) break;
+    configuration->tierCount++;
+  }
+
+  parseContextDispose(ctx);
+  free(fdata);
+  sessionConfigurationPrint(configuration);
+  return 0;
+}
+
 //====================================================[UNIFORMS]=============================================
 
 union UniformValue {
@@ -648,10 +2670,16 @@ struct ShaderUniforms {
   int   userTextures[32];
 
   float maxVolume;
+  int   frame;
+  float timeDelta;
+  float channelResolution[MAX_CHANNELS][3];
 
   //System data
   GLuint userTexturesId[MAX_TEXTURE_SLOTS];
   int    userTexturesCount;
+  GLuint userTextureArrayId; // Replaces userTexturesId with texturearray=1, bound on TEXTURE_ARRAY_UNIT
+  GLuint channelTexturesId[MAX_CHANNELS]; // Bound on units after the user textures
+  float  lastTime;
 
   //Locations
   GLint iQuality;
@@ -672,7 +2700,12 @@ struct ShaderUniforms {
   GLint iJoyStates;
   GLint iSampleStates;
   GLint iUserTextures;
+  GLint iUserTextureArray;
   GLint iMaxVolume;
+  GLint iFrame;
+  GLint iTimeDelta;
+  GLint iChannelResolution;
+  GLint iChannel[MAX_CHANNELS];
 
   GLint              hintUniforms[MAX_HINT_UNIFORMS];
   GLenum             hintUniformsType[MAX_HINT_UNIFORMS];
@@ -708,10 +2741,31 @@ void shaderUniformsInitLocations(struct ShaderUniforms* u, GLuint program) {
   GET_LOC(iJoyStates, "iJoyStates");
   GET_LOC(iSampleStates, "iSampleStates");
   GET_LOC(iUserTextures, "iUserTextures");
+  GET_LOC(iUserTextureArray, "iUserTextureArray");
+  GET_LOC(iFrame, "iFrame");
+  GET_LOC(iTimeDelta, "iTimeDelta");
+  GET_LOC(iChannelResolution, "iChannelResolution");
+  GET_LOC(iChannel[0], "iChannel0");
+  GET_LOC(iChannel[1], "iChannel1");
+  GET_LOC(iChannel[2], "iChannel2");
+  GET_LOC(iChannel[3], "iChannel3");
 
 #undef GET_LOC
 }
 
+int shaderUniformsUsesInput(struct ShaderUniforms* u) {
+  return u->iMouse != -1 || u->iX != -1 || u->iY != -1 || u->iKeyStates != -1 || u->iScroll != -1;
+}
+
+//Returns whether the program consumes time or input, static programs only need to be drawn on demand
+int shaderUniformsIsAnimated(struct ShaderUniforms* u) {
+  return u->iTime != -1 || u->iFrame != -1 || u->iTimeDelta != -1 || shaderUniformsUsesInput(u);
+}
+
+uint64_t shaderUniformsHashUser(struct ShaderUniforms* u) {
+  return hashBytes(HASH_SEED, u->hintUniformsValue, u->hintUniformsCount * sizeof(union UniformValue));
+}
+
 void shaderUniformsUpload(struct ShaderUniforms* u) {
   if (u->iQuality != -1) glUniform1f(u->iQuality, u->quality);
   if (u->iCameraPosition != -1) glUniform3fv(u->iCameraPosition, 1, u->cameraPosition);
@@ -745,6 +2799,29 @@ void shaderUniformsUpload(struct ShaderUniforms* u) {
       glBindTexture(GL_TEXTURE_2D, u->userTexturesId[i]);
     }
   }
+
+  if (u->userTextureArrayId) {
+    if (u->iUserTextureArray != -1) glUniform1i(u->iUserTextureArray, TEXTURE_ARRAY_UNIT);
+    glActiveTexture(GL_TEXTURE0 + TEXTURE_ARRAY_UNIT);
+    glBindTexture(GL_TEXTURE_2D_ARRAY, u->userTextureArrayId);
+  }
+
+  if (u->iFrame != -1) glUniform1i(u->iFrame, u->frame);
+  if (u->iTimeDelta != -1) glUniform1f(u->iTimeDelta, u->timeDelta);
+  if (u->iChannelResolution != -1) glUniform3fv(u->iChannelResolution, MAX_CHANNELS, &u->channelResolution[0][0]);
+  for (int i = 0; i < MAX_CHANNELS; ++i) {
+    if (u->iChannel[i] == -1) continue;
+    glUniform1i(u->iChannel[i], MAX_TEXTURE_SLOTS + i);
+    glActiveTexture(GL_TEXTURE0 + MAX_TEXTURE_SLOTS + i);
+    glBindTexture(GL_TEXTURE_2D, u->channelTexturesId[i]);
+  }
+  glActiveTexture(GL_TEXTURE0);
+}
+
+//Updates iTimeDelta before drawing frame number u->frame, the frame counter is advanced after it is drawn
+void shaderUniformsBeginFrame(struct ShaderUniforms* u) {
+  u->timeDelta = u->frame > 0 ? u->time - u->lastTime : 0.0f;
+  u->lastTime  = u->time;
 }
 
 void shaderUserUniformsUpload(struct ShaderUniforms* u) {
@@ -829,6 +2906,78 @@ void shaderUniformsFindUserDefined(struct ShaderUniforms* u, GLuint program) {
   printf("Successfully registered %d user-defined uniforms.\n\n", u->hintUniformsCount);
 }
 
+//Parses a configuration value such as "0.5" or "1 0.5 0" into a user uniform of the given type
+int shaderUniformsParseValue(union UniformValue* value, GLenum type, const char* text) {
+  switch (type) {
+    case GL_FLOAT: return sscanf(text, "%f", &value->f_val) == 1;
+    case GL_INT: return sscanf(text, "%d", &value->i_val) == 1;
+    case GL_FLOAT_VEC2: return sscanf(text, "%f %f", &value->v2_val[0], &value->v2_val[1]) == 2;
+    case GL_FLOAT_VEC3: return sscanf(text, "%f %f %f", &value->v3_val[0], &value->v3_val[1], &value->v3_val[2]) == 3;
+    case GL_SAMPLER_2D: return sscanf(text, "%d", &value->s_val) == 1;
+    default: return 0;
+  }
+}
+
+void shaderUniformsApplyDefaults(struct ShaderUniforms* u, struct SessionConfiguration* config) {
+  for (int i = 0; i < u->hintUniformsCount; i++) {
+    for (int j = 0; j < config->uniformCount; j++) {
+      if (strcmp(u->hintUniformsName[i], config->uniformName[j]) == 0 &&
+          !shaderUniformsParseValue(&u->hintUniformsValue[i], u->hintUniformsType[i], config->uniformValue[j]))
+        fprintf(stderr, "[WARN] Cannot parse value \"%s\" of uniform %s\n", config->uniformValue[j], config->uniformName[j]);
+    }
+  }
+}
+
+//Writes the GLSL constant expression for a user uniform value into dst, returns 0 for types that cannot be constant
+int shaderUniformsLiteral(char* dst, size_t size, GLenum type, union UniformValue* value) {
+  switch (type) {
+    case GL_FLOAT: snprintf(dst, size, "float(%.9g)", value->f_val); return 1;
+    case GL_INT: snprintf(dst, size, "int(%d)", value->i_val); return 1;
+    case GL_FLOAT_VEC2: snprintf(dst, size, "vec2(%.9g, %.9g)", value->v2_val[0], value->v2_val[1]); return 1;
+    case GL_FLOAT_VEC3: snprintf(dst, size, "vec3(%.9g, %.9g, %.9g)", value->v3_val[0], value->v3_val[1], value->v3_val[2]); return 1;
+    case GL_FLOAT_MAT4: {
+      size_t length = snprintf(dst, size, "mat4(");
+      for (int i = 0; i < 16 && length < size; i++)
+        length += snprintf(dst + length, size - length, i < 15 ? "%.9g, " : "%.9g)", value->m4_val[i]);
+      return 1;
+    }
+    default: return 0;
+  }
+}
+
+//Rewrites plain "uniform <type> <name>;" declarations of user uniforms into constants holding their current
+//values so the driver can fold them. Declarations listing several names are left alone.
+char* glslFreezeUniforms(const char* source, struct ShaderUniforms* u, int* frozen) {
+  struct ShaderSourceBuffer out = {0};
+  const char*               cursor = source;
+  *frozen                          = 0;
+
+  while (*cursor) {
+    const char* end    = strchr(cursor, '\n');
+    size_t      length = end ? (size_t)(end - cursor + 1) : strlen(cursor);
+    const char* token  = cursor + strspn(cursor, " \t");
+
+    char type[64], name[MAX_UNIFORM_NAME_LENGTH], literal[MAX_LINE_LENGTH];
+    int  consumed = 0, replaced = 0;
+    if (strncmp(token, "uniform", 7) == 0 && sscanf(token, "uniform %63s %255[A-Za-z0-9_] ;%n", type, name, &consumed) == 2 && consumed > 0) {
+      for (int i = 0; i < u->hintUniformsCount && !replaced; i++) {
+        if (strcmp(u->hintUniformsName[i], name) || !shaderUniformsLiteral(literal, sizeof(literal), u->hintUniformsType[i], &u->hintUniformsValue[i]))
+          continue;
+
+        char declaration[MAX_LINE_LENGTH * 2];
+        int  written = snprintf(declaration, sizeof(declaration), "const %s %s = %s;", type, name, literal);
+        shaderSourceAppend(&out, declaration, written);
+        shaderSourceAppend(&out, token + consumed, length - (token + consumed - cursor));
+        replaced = 1;
+        (*frozen)++;
+      }
+    }
+    if (!replaced) shaderSourceAppend(&out, cursor, length);
+    cursor += length;
+  }
+  return out.data;
+}
+
 struct InputState {
   int   mouseX;
   int   mouseY;
@@ -894,51 +3043,1920 @@ void shaderUniformsUpdate(struct ShaderUniforms* u, const struct InputState* inp
   memset(u->sampleStates, 0, sizeof(u->sampleStates)); // Clear if not updated by audio samples
 }
 
+//=========================================================[FRAME PACING]================================================
+
+int glxHasExtension(Display* dpy, int screen, const char* name) {
+  const char* extensions = glXQueryExtensionsString(dpy, screen);
+  size_t      len        = strlen(name);
+
+  while (extensions && (extensions = strstr(extensions, name))) {
+    if (extensions[len] == ' ' || extensions[len] == 0) return 1;
+    extensions += len;
+  }
+  return 0;
+}
+
+//Sets the swap interval through GLX_EXT_swap_control or GLX_MESA_swap_control, whichever is available
+int glxSwapIntervalSet(Display* dpy, Window win, int interval) {
+  int screen = DefaultScreen(dpy);
+
+  if (glxHasExtension(dpy, screen, "GLX_EXT_swap_control")) {
+    glXSwapIntervalEXTProc swapIntervalEXT = (glXSwapIntervalEXTProc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalEXT");
+    if (swapIntervalEXT) {
+      swapIntervalEXT(dpy, win, interval);
+      fprintf(stderr, "[OK] Swap interval %d (GLX_EXT_swap_control)\n", interval);
+      return 0;
+    }
+  }
+
+  if (glxHasExtension(dpy, screen, "GLX_MESA_swap_control")) {
+    glXSwapIntervalMESAProc swapIntervalMESA = (glXSwapIntervalMESAProc)glXGetProcAddressARB((const GLubyte*)"glXSwapIntervalMESA");
+    if (swapIntervalMESA && swapIntervalMESA(interval) == 0) {
+      fprintf(stderr, "[OK] Swap interval %d (GLX_MESA_swap_control)\n", interval);
+      return 0;
+    }
+  }
+
+  fprintf(stderr, "[WARN] No GLX swap control extension available, swap interval unchanged\n");
+  return 1;
+}
+
+struct FramePacer {
+  long long period;   // Nanoseconds per frame, 0 when unpaced
+  long long deadline; // CLOCK_MONOTONIC time at which the next frame is due
+  long long lastReport;
+  int       timerfd;
+  int       wakefds[2]; // Extra descriptors that interrupt the wait, -1 when unused
+  int       idle;       // The loop stopped wanting frames, resync on the next one
+  long      frames;
+  long      late;   // Frames presented after their deadline
+  long      missed; // Whole frame periods that passed without a presented frame
+};
+
+void framePacerInit(struct FramePacer* pacer, int targetFps) {
+  memset(pacer, 0, sizeof(*pacer));
+  pacer->period     = targetFps > 0 ? 1000000000LL / targetFps : 0;
+  pacer->deadline   = monotonicNow();
+  pacer->lastReport = monotonicNow();
+  pacer->timerfd    = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+  pacer->wakefds[0] = pacer->wakefds[1] = -1;
+  if (pacer->timerfd == -1) perror("[ERR] timerfd_create");
+}
+
+void framePacerDispose(struct FramePacer* pacer) {
+  if (pacer->timerfd != -1) close(pacer->timerfd);
+}
+
+int framePacerDue(struct FramePacer* pacer) {
+  return pacer->period == 0 || monotonicNow() >= pacer->deadline;
+}
+
+//Called right after the buffer swap, accounts the frame against its deadline and schedules the next one
+void framePacerPresent(struct FramePacer* pacer) {
+  long long now = monotonicNow();
+  pacer->frames++;
+
+  if (pacer->period > 0) {
+    pacer->deadline += pacer->period;
+
+    if (now > pacer->deadline) {
+      long long overrun = (now - pacer->deadline) / pacer->period;
+      pacer->late++;
+
+      //Resync instead of trying to catch up with a burst of frames
+      if (overrun > 0) {
+        pacer->missed += overrun;
+        pacer->deadline = now;
+      }
+    }
+  }
+
+  if (now - pacer->lastReport > PACER_REPORT_INTERVAL * 1000000000LL) {
+    fprintf(stderr, "[PACER] frames: %ld late: %ld missed: %ld\n", pacer->frames, pacer->late, pacer->missed);
+    pacer->lastReport = now;
+  }
+}
+
+//Blocks on the X connection and the wake descriptors until an event arrives or, when a frame is wanted, until the frame deadline.
+//With no frame wanted the loop sleeps until the next X event.
+void framePacerWait(struct FramePacer* pacer, Display* dpy, int wantFrame) {
+  if (!wantFrame) {
+    pacer->idle = 1;
+  } else if (pacer->idle) {
+    pacer->idle     = 0;
+    pacer->deadline = monotonicNow();
+  }
+
+  if (XPending(dpy)) return;
+  if (wantFrame && framePacerDue(pacer)) return;
+
+  struct itimerspec spec = {0};
+  if (wantFrame) {
+    spec.it_value.tv_sec  = pacer->deadline / 1000000000LL;
+    spec.it_value.tv_nsec = pacer->deadline % 1000000000LL;
+  }
+  timerfd_settime(pacer->timerfd, TFD_TIMER_ABSTIME, &spec, NULL);
+
+  struct pollfd fds[4] = {
+    {ConnectionNumber(dpy), POLLIN, 0},
+    {pacer->timerfd, POLLIN, 0},
+    {pacer->wakefds[0], POLLIN, 0},
+    {pacer->wakefds[1], POLLIN, 0}};
+
+  if (poll(fds, 4, -1) > 0 && (fds[1].revents & POLLIN)) {
+    uint64_t expirations;
+    if (read(pacer->timerfd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN)
+      perror("[ERR] timerfd read");
+  }
+}
+
+//=========================================================[PROFILER]====================================================
+
+enum ProfilerStage {
+  PROFILER_STAGE_BEGIN_FBO = 0,
+  PROFILER_STAGE_BUFFERS, // Render graph buffer passes
+  PROFILER_STAGE_DRAW,
+  PROFILER_STAGE_END_FBO,
+  PROFILER_STAGE_GUI,
+  PROFILER_STAGE_SWAP,
+  PROFILER_STAGE_COUNT
+};
+
+const char* profilerStageNames[PROFILER_STAGE_COUNT] = {"beginfbo", "buffers", "draw", "endfbo", "gui", "swap"};
+
+struct GpuProfilerFrame {
+  GLuint queries[PROFILER_STAGE_COUNT][2]; // GL_TIMESTAMP at the start and end of every stage
+  int    used;                             // Bitmask of the stages issued this frame
+  int    pending;                          // Waiting for the results to become available
+};
+
+struct GpuProfilerHistogram {
+  float samples[PROFILER_SAMPLES]; // Milliseconds, rolling window
+  int   count;
+  int   next;
+};
+
+struct GpuProfilerStats {
+  float avg;
+  float p50;
+  float p95;
+  float p99;
+  int   count;
+};
+
+struct GpuProfiler {
+  struct GpuProfilerFrame     frames[PROFILER_FRAMES];
+  struct GpuProfilerHistogram stages[PROFILER_STAGE_COUNT];
+  struct GpuProfilerHistogram frame; // Sum of all stages
+  float                       lastFrameMs;
+  long                        collected; // Number of frames read back so far
+  int                         current;
+  int                         recording; // Current ring slot is free, queries are issued
+  int                         initialized;
+};
+
+struct GpuProfiler gpuProfiler;
+
+volatile sig_atomic_t profilerDumpRequested;
+
+void gpuProfilerSignalHandler(int signal) {
+  (void)signal;
+  profilerDumpRequested = 1;
+}
+
+void gpuProfilerInit(struct GpuProfiler* profiler) {
+  memset(profiler, 0, sizeof(*profiler));
+  for (int i = 0; i < PROFILER_FRAMES; i++)
+    glGenQueries(PROFILER_STAGE_COUNT * 2, &profiler->frames[i].queries[0][0]);
+  profiler->current     = PROFILER_FRAMES - 1;
+  profiler->initialized = 1;
+
+  struct sigaction action = {0};
+  action.sa_handler       = gpuProfilerSignalHandler;
+  sigemptyset(&action.sa_mask);
+  sigaction(SIGUSR1, &action, NULL);
+}
+
+void gpuProfilerDispose(struct GpuProfiler* profiler) {
+  if (!profiler->initialized) return;
+  for (int i = 0; i < PROFILER_FRAMES; i++)
+    glDeleteQueries(PROFILER_STAGE_COUNT * 2, &profiler->frames[i].queries[0][0]);
+  profiler->initialized = 0;
+}
+
+void gpuProfilerHistogramPush(struct GpuProfilerHistogram* histogram, float value) {
+  histogram->samples[histogram->next] = value;
+  histogram->next                     = (histogram->next + 1) % PROFILER_SAMPLES;
+  if (histogram->count < PROFILER_SAMPLES) histogram->count++;
+}
+
+//Reads back every pending frame whose queries already finished, never waits on the GPU
+void gpuProfilerCollect(struct GpuProfiler* profiler) {
+  for (int n = 1; n <= PROFILER_FRAMES; n++) {
+    struct GpuProfilerFrame* frame = &profiler->frames[(profiler->current + n) % PROFILER_FRAMES];
+    if (!frame->pending) continue;
+
+    int available = 1;
+    for (int stage = 0; stage < PROFILER_STAGE_COUNT && available; stage++) {
+      if (!(frame->used & (1 << stage))) continue;
+      GLint result = 0;
+      glGetQueryObjectiv(frame->queries[stage][1], GL_QUERY_RESULT_AVAILABLE, &result);
+      available = result;
+    }
+    if (!available) continue;
+
+    float total = 0.0f;
+    for (int stage = 0; stage < PROFILER_STAGE_COUNT; stage++) {
+      if (!(frame->used & (1 << stage))) continue;
+      GLuint64 begin, end;
+      glGetQueryObjectui64v(frame->queries[stage][0], GL_QUERY_RESULT, &begin);
+      glGetQueryObjectui64v(frame->queries[stage][1], GL_QUERY_RESULT, &end);
+
+      float ms = (end - begin) / 1e6f;
+      gpuProfilerHistogramPush(&profiler->stages[stage], ms);
+      total += ms;
+    }
+    gpuProfilerHistogramPush(&profiler->frame, total);
+    profiler->lastFrameMs = total;
+    profiler->collected++;
+    frame->pending = 0;
+  }
+}
+
+void gpuProfilerBeginFrame(struct GpuProfiler* profiler) {
+  if (!profiler->initialized) return;
+  gpuProfilerCollect(profiler);
+
+  //If the slot is still in flight the frame is not profiled rather than stalling on it
+  profiler->current   = (profiler->current + 1) % PROFILER_FRAMES;
+  profiler->recording = !profiler->frames[profiler->current].pending;
+  if (profiler->recording) profiler->frames[profiler->current].used = 0;
+}
+
+void gpuProfilerEndFrame(struct GpuProfiler* profiler) {
+  if (!profiler->initialized || !profiler->recording) return;
+  profiler->frames[profiler->current].pending = profiler->frames[profiler->current].used != 0;
+  profiler->recording                         = 0;
+}
+
+void gpuProfilerBegin(struct GpuProfiler* profiler, enum ProfilerStage stage) {
+  if (!profiler->recording) return;
+  glQueryCounter(profiler->frames[profiler->current].queries[stage][0], GL_TIMESTAMP);
+}
+
+void gpuProfilerEnd(struct GpuProfiler* profiler, enum ProfilerStage stage) {
+  if (!profiler->recording) return;
+  glQueryCounter(profiler->frames[profiler->current].queries[stage][1], GL_TIMESTAMP);
+  profiler->frames[profiler->current].used |= 1 << stage;
+}
+
+int floatCompare(const void* a, const void* b) {
+  float x = *(const float*)a, y = *(const float*)b;
+  return (x > y) - (x < y);
+}
+
+void gpuProfilerHistogramStats(struct GpuProfilerHistogram* histogram, struct GpuProfilerStats* stats) {
+  memset(stats, 0, sizeof(*stats));
+  stats->count = histogram->count;
+  if (histogram->count == 0) return;
+
+  float sorted[PROFILER_SAMPLES];
+  float sum = 0.0f;
+  memcpy(sorted, histogram->samples, histogram->count * sizeof(float));
+  qsort(sorted, histogram->count, sizeof(float), floatCompare);
+  for (int i = 0; i < histogram->count; i++) sum += sorted[i];
+
+  stats->avg = sum / histogram->count;
+  stats->p50 = sorted[(histogram->count - 1) * 50 / 100];
+  stats->p95 = sorted[(histogram->count - 1) * 95 / 100];
+  stats->p99 = sorted[(histogram->count - 1) * 99 / 100];
+}
+
+//Stage statistics in milliseconds over the last PROFILER_SAMPLES profiled frames
+void gpuProfilerStats(struct GpuProfiler* profiler, enum ProfilerStage stage, struct GpuProfilerStats* stats) {
+  gpuProfilerHistogramStats(&profiler->stages[stage], stats);
+}
+
+void gpuProfilerFrameStats(struct GpuProfiler* profiler, struct GpuProfilerStats* stats) {
+  gpuProfilerHistogramStats(&profiler->frame, stats);
+}
+
+void gpuProfilerDump(struct GpuProfiler* profiler, FILE* out) {
+  struct GpuProfilerStats stats;
+  fprintf(out, "[PROFILER] %-9s %8s %8s %8s %8s %6s\n", "stage", "avg", "p50", "p95", "p99", "count");
+  for (int stage = 0; stage < PROFILER_STAGE_COUNT; stage++) {
+    gpuProfilerStats(profiler, stage, &stats);
+    fprintf(out, "[PROFILER] %-9s %8.3f %8.3f %8.3f %8.3f %6d\n", profilerStageNames[stage], stats.avg, stats.p50, stats.p95, stats.p99, stats.count);
+  }
+  gpuProfilerFrameStats(profiler, &stats);
+  fprintf(out, "[PROFILER] %-9s %8.3f %8.3f %8.3f %8.3f %6d\n", "frame", stats.avg, stats.p50, stats.p95, stats.p99, stats.count);
+}
+
+//=========================================================[RESOLUTION GOVERNOR]=========================================
+
+struct ResolutionGovernor {
+  float budget; // Target GPU frame time in milliseconds, 0 disables the governor
+  float minScale;
+  float maxScale;
+  float scale;   // Fraction of the screen resolution rendered
+  float average; // Exponential moving average of the GPU frame time
+  int   samples; // Samples taken since the last scale change
+  int   over;    // Consecutive samples above budget
+  int   under;   // Consecutive samples well below budget
+  long  seen;    // Profiler frames already consumed
+  int   tier;      // Requested quality tier, tierCount is the base program
+  int   tierCount; // Tiers are traded only once the scale reached its bounds
+
+  long long start;
+  long long logTime[GOVERNOR_LOG_SIZE];
+  float     logScale[GOVERNOR_LOG_SIZE];
+  int       logTier[GOVERNOR_LOG_SIZE];
+  int       logCount;
+  int       logNext;
+};
+
+//Snaps scales to GOVERNOR_SCALE_STEP so small fluctuations do not reallocate the render target
+float resolutionGovernorQuantize(float scale) {
+  float steps = floorf(scale / GOVERNOR_SCALE_STEP + 0.001f);
+  return steps < 1.0f ? GOVERNOR_SCALE_STEP : steps * GOVERNOR_SCALE_STEP;
+}
+
+void resolutionGovernorInit(struct ResolutionGovernor* governor, float budget, float minScale, float maxScale, int tierCount) {
+  memset(governor, 0, sizeof(*governor));
+  governor->budget    = budget;
+  governor->minScale  = minScale;
+  governor->maxScale  = maxScale;
+  governor->scale     = maxScale;
+  governor->tier      = tierCount;
+  governor->tierCount = tierCount;
+  governor->start     = monotonicNow();
+}
+
+void resolutionGovernorLog(struct ResolutionGovernor* governor, float from, int fromTier) {
+  long long now                         = monotonicNow();
+  governor->logTime[governor->logNext]  = now;
+  governor->logScale[governor->logNext] = governor->scale;
+  governor->logTier[governor->logNext]  = governor->tier;
+  governor->logNext                     = (governor->logNext + 1) % GOVERNOR_LOG_SIZE;
+  if (governor->logCount < GOVERNOR_LOG_SIZE) governor->logCount++;
+
+  fprintf(stderr, "[GOVERNOR] t=%.1fs scale %.3f -> %.3f tier %d -> %d (gpu %.2fms, budget %.2fms)\n",
+          (now - governor->start) / 1e9, from, governor->scale, fromTier, governor->tier, governor->average, governor->budget);
+}
+
+void resolutionGovernorDump(struct ResolutionGovernor* governor, FILE* out) {
+  for (int i = 0; i < governor->logCount; i++) {
+    int index = (governor->logNext - governor->logCount + i + GOVERNOR_LOG_SIZE) % GOVERNOR_LOG_SIZE;
+    fprintf(out, "[GOVERNOR] t=%.1fs scale %.3f tier %d\n", (governor->logTime[index] - governor->start) / 1e9, governor->logScale[index], governor->logTier[index]);
+  }
+}
+
+//Feeds the latest GPU frame time and returns the render scale to use.
+//Scaling down reacts after a short streak over budget, scaling up needs a longer streak with headroom
+//so the two thresholds never chase each other. Once the scale is at minScale the quality tier is lowered
+//instead, and it is raised again only from maxScale.
+float resolutionGovernorUpdate(struct ResolutionGovernor* governor, struct GpuProfiler* profiler) {
+  if (governor->budget <= 0.0f || profiler->collected == governor->seen) return governor->scale;
+  governor->seen = profiler->collected;
+
+  float ms          = profiler->lastFrameMs;
+  governor->average = governor->samples == 0 ? ms : governor->average * 0.9f + ms * 0.1f;
+  if (++governor->samples < GOVERNOR_SETTLE_FRAMES) return governor->scale;
+
+  governor->over  = governor->average > governor->budget ? governor->over + 1 : 0;
+  governor->under = governor->average < governor->budget * GOVERNOR_HEADROOM ? governor->under + 1 : 0;
+
+  float from     = governor->scale;
+  float scale    = from;
+  int   fromTier = governor->tier;
+
+  // Cost is proportional to the pixel count, so the scale follows the square root of the ratio
+  if (governor->over >= GOVERNOR_PATIENCE && from <= governor->minScale && governor->tier > 0) {
+    governor->tier--;
+  } else if (governor->under >= GOVERNOR_PATIENCE * 4 && from >= governor->maxScale && governor->tier < governor->tierCount) {
+    governor->tier++;
+  } else if (governor->over >= GOVERNOR_PATIENCE) {
+    scale = from * sqrtf(governor->budget / governor->average);
+    scale = resolutionGovernorQuantize(scale < from - GOVERNOR_SCALE_STEP ? scale : from - GOVERNOR_SCALE_STEP);
+  } else if (governor->under >= GOVERNOR_PATIENCE * 4) {
+    float target = from * sqrtf(governor->budget * GOVERNOR_HEADROOM / governor->average);
+    scale        = resolutionGovernorQuantize(target < from * 1.25f ? target : from * 1.25f);
+    if (scale <= from) scale = from + GOVERNOR_SCALE_STEP;
+  }
+
+  if (scale < governor->minScale) scale = governor->minScale;
+  if (scale > governor->maxScale) scale = governor->maxScale;
+
+  if (scale != from || governor->tier != fromTier) {
+    governor->scale   = scale;
+    governor->samples = 0;
+    governor->over    = 0;
+    governor->under   = 0;
+    resolutionGovernorLog(governor, from, fromTier);
+  }
+  return governor->scale;
+}
+
+//=========================================================[OCCLUSION]===================================================
+
+struct OcclusionTracker {
+  Atom netActiveWindow;
+  Atom netWmState;
+  Atom netWmStateFullscreen;
+  Atom netWmStateMaximizedVert;
+  Atom netWmStateMaximizedHorz;
+  Atom netWmStateHidden;
+  Atom netWorkarea;
+
+  Window    root;
+  Window    win;
+  Window    active;
+  int       obscured;     // VisibilityNotify reported the desktop window as fully obscured
+  int       activeCovers; // The active client is fullscreen or maximized over the whole work area
+  long long suspendedSince;
+  long long suspendedTotal; // Nanoseconds spent with rendering suspended
+};
+
+int occlusionIgnoreErrors(Display* dpy, XErrorEvent* error) {
+  (void)dpy;
+  (void)error;
+  return 0;
+}
+
+//Reads an ATOM or CARDINAL list property, returns the number of items read
+int xPropertyRead(Display* dpy, Window win, Atom property, Atom type, long* items, int maxItems) {
+  Atom           actualType;
+  int            actualFormat;
+  unsigned long  count, bytesAfter;
+  unsigned char* data = NULL;
+
+  if (XGetWindowProperty(dpy, win, property, 0, maxItems, False, type, &actualType, &actualFormat, &count, &bytesAfter, &data) != Success || !data)
+    return 0;
+
+  int n = actualFormat == 32 ? (int)count : 0;
+  for (int i = 0; i < n && i < maxItems; i++) items[i] = ((long*)data)[i];
+  XFree(data);
+  return n < maxItems ? n : maxItems;
+}
+
+//Checks whether the active client hides the whole work area (everything outside of it belongs to docks and panels)
+int occlusionActiveCovers(struct OcclusionTracker* tracker, Display* dpy) {
+  if (tracker->active == None || tracker->active == tracker->win) return 0;
+
+  long state[16];
+  int  count = xPropertyRead(dpy, tracker->active, tracker->netWmState, XA_ATOM, state, 16);
+  int  fullscreen = 0, maxVert = 0, maxHorz = 0;
+  for (int i = 0; i < count; i++) {
+    if ((Atom)state[i] == tracker->netWmStateHidden) return 0;
+    if ((Atom)state[i] == tracker->netWmStateFullscreen) fullscreen = 1;
+    if ((Atom)state[i] == tracker->netWmStateMaximizedVert) maxVert = 1;
+    if ((Atom)state[i] == tracker->netWmStateMaximizedHorz) maxHorz = 1;
+  }
+  if (!fullscreen && !(maxVert && maxHorz)) return 0;
+
+  XWindowAttributes rootAttributes, attributes;
+  Window            child;
+  int               x, y;
+  if (!XGetWindowAttributes(dpy, tracker->root, &rootAttributes) ||
+      !XGetWindowAttributes(dpy, tracker->active, &attributes) ||
+      !XTranslateCoordinates(dpy, tracker->active, tracker->root, 0, 0, &x, &y, &child))
+    return 0;
+
+  long area[4] = {0, 0, rootAttributes.width, rootAttributes.height};
+  if (!fullscreen) xPropertyRead(dpy, tracker->root, tracker->netWorkarea, XA_CARDINAL, area, 4);
+
+  return x <= area[0] && y <= area[1] &&
+    x + attributes.width >= area[0] + area[2] &&
+    y + attributes.height >= area[1] + area[3];
+}
+
+void occlusionTrackerRefresh(struct OcclusionTracker* tracker, Display* dpy) {
+  XErrorHandler previous = XSetErrorHandler(occlusionIgnoreErrors);
+
+  long   active    = None;
+  Window oldActive = tracker->active;
+  xPropertyRead(dpy, tracker->root, tracker->netActiveWindow, XA_WINDOW, &active, 1);
+  tracker->active = (Window)active;
+
+  //Follow _NET_WM_STATE changes on the active client
+  if (oldActive != tracker->active) {
+    if (oldActive != None && oldActive != tracker->win) XSelectInput(dpy, oldActive, NoEventMask);
+    if (tracker->active != None && tracker->active != tracker->win) XSelectInput(dpy, tracker->active, PropertyChangeMask);
+  }
+
+  tracker->activeCovers = occlusionActiveCovers(tracker, dpy);
+
+  XSync(dpy, False);
+  XSetErrorHandler(previous);
+}
+
+void occlusionTrackerInit(struct OcclusionTracker* tracker, Display* dpy, Window win) {
+  memset(tracker, 0, sizeof(*tracker));
+  tracker->netActiveWindow         = XInternAtom(dpy, "_NET_ACTIVE_WINDOW", False);
+  tracker->netWmState              = XInternAtom(dpy, "_NET_WM_STATE", False);
+  tracker->netWmStateFullscreen    = XInternAtom(dpy, "_NET_WM_STATE_FULLSCREEN", False);
+  tracker->netWmStateMaximizedVert = XInternAtom(dpy, "_NET_WM_STATE_MAXIMIZED_VERT", False);
+  tracker->netWmStateMaximizedHorz = XInternAtom(dpy, "_NET_WM_STATE_MAXIMIZED_HORZ", False);
+  tracker->netWmStateHidden        = XInternAtom(dpy, "_NET_WM_STATE_HIDDEN", False);
+  tracker->netWorkarea             = XInternAtom(dpy, "_NET_WORKAREA", False);
+  tracker->root                    = DefaultRootWindow(dpy);
+  tracker->win                     = win;
+
+  XSelectInput(dpy, tracker->root, PropertyChangeMask);
+  occlusionTrackerRefresh(tracker, dpy);
+}
+
+void occlusionTrackerHandleEvent(struct OcclusionTracker* tracker, Display* dpy, XEvent* ev) {
+  if (ev->type == VisibilityNotify && ev->xvisibility.window == tracker->win) {
+    tracker->obscured = ev->xvisibility.state == VisibilityFullyObscured;
+  } else if (ev->type == PropertyNotify) {
+    if ((ev->xproperty.window == tracker->root && ev->xproperty.atom == tracker->netActiveWindow) ||
+        (ev->xproperty.window == tracker->active && ev->xproperty.atom == tracker->netWmState))
+      occlusionTrackerRefresh(tracker, dpy);
+  }
+}
+
+//Updates the suspended time accounting, returns whether rendering should be suspended
+int occlusionTrackerSuspended(struct OcclusionTracker* tracker) {
+  int       suspended = tracker->obscured || tracker->activeCovers;
+  long long now       = monotonicNow();
+
+  if (suspended && !tracker->suspendedSince) {
+    tracker->suspendedSince = now;
+    fprintf(stderr, "[OCCLUSION] Desktop hidden, rendering suspended\n");
+  } else if (!suspended && tracker->suspendedSince) {
+    long long elapsed = now - tracker->suspendedSince;
+    tracker->suspendedTotal += elapsed;
+    tracker->suspendedSince = 0;
+    fprintf(stderr, "[OCCLUSION] Desktop visible, resumed after %.1fs (total suspended %.1fs)\n",
+            elapsed / 1e9, tracker->suspendedTotal / 1e9);
+  }
+  return suspended;
+}
+
+//=========================================================[TILED RENDERING]=============================================
+
+// Progressive mode for shaders too heavy to draw in one go: the frame is split in a grid of scissored tiles rendered
+// over several loop iterations, each limited by a GPU time budget, while the last completed frame is presented.
+struct TiledRenderer {
+  int                  grid;   // Tiles per side, 1 disables tiling
+  float                budget; // GPU milliseconds per slice
+  int                  next;   // Next tile of the frame being built
+  int                  inProgress;
+  float                frameTime; // iTime of the frame being built
+  struct glFrameBuffer target[2];
+  int                  building; // Index of the target being built, the other one holds the completed frame
+  int                  hasCompleted;
+  GLuint               query;
+  int                  queryPending;
+  int                  queryTiles; // Tiles measured by the pending query
+  float                tileMs;     // Estimated GPU cost of one tile
+  int                  lastSliceTiles;
+  long                 frames; // Completed frames
+};
+
+int tiledRendererCreate(struct TiledRenderer* tiled, int grid, float budget) {
+  memset(tiled, 0, sizeof(*tiled));
+  tiled->grid   = grid > 1 ? grid : 1;
+  tiled->budget = budget > 0.0f ? budget : DEFAULT_SLICE_BUDGET;
+  if (tiled->grid == 1) return 0;
+
+  glGenQueries(1, &tiled->query);
+  if (glFrameBufferCreate(&tiled->target[0], glFrameBufferColor(720, 640, GL_RGBA8)) ||
+      glFrameBufferCreate(&tiled->target[1], glFrameBufferColor(720, 640, GL_RGBA8))) {
+    fprintf(stderr, "[ERR] Tiled rendering unavailable\n");
+    tiled->grid = 1;
+    return 1;
+  }
+  return 0;
+}
+
+void tiledRendererDispose(struct TiledRenderer* tiled) {
+  if (!tiled->query) return;
+  glDeleteQueries(1, &tiled->query);
+  glFrameBufferDispose(&tiled->target[0]);
+  glFrameBufferDispose(&tiled->target[1]);
+}
+
+//Updates the per tile cost estimate from the last slice without waiting for the GPU
+void tiledRendererMeasure(struct TiledRenderer* tiled) {
+  if (!tiled->queryPending) return;
+
+  GLint available = 0;
+  glGetQueryObjectiv(tiled->query, GL_QUERY_RESULT_AVAILABLE, &available);
+  if (!available) return;
+
+  GLuint64 elapsed;
+  glGetQueryObjectui64v(tiled->query, GL_QUERY_RESULT, &elapsed);
+  float ms            = elapsed / 1e6f / tiled->queryTiles;
+  tiled->tileMs       = tiled->tileMs == 0.0f ? ms : tiled->tileMs * 0.7f + ms * 0.3f;
+  tiled->queryPending = 0;
+}
+
+//Renders as many tiles as fit in the budget, returns whether a frame was completed
+int tiledRendererSlice(struct TiledRenderer* tiled, GLuint program, struct ShaderUniforms* uniforms, int width, int height, GLuint vao) {
+  int total = tiled->grid * tiled->grid;
+
+  if (!tiled->inProgress) {
+    tiled->inProgress = 1;
+    tiled->next       = 0;
+    tiled->frameTime  = uniforms->time;
+    glFrameBufferResize(&tiled->target[tiled->building], width, height);
+  }
+
+  tiledRendererMeasure(tiled);
+
+  int count = tiled->tileMs > 0.0f ? (int)(tiled->budget / tiled->tileMs) : 1;
+  if (count < 1) count = 1;
+  if (count > total - tiled->next) count = total - tiled->next;
+
+  struct glFrameBuffer* target = &tiled->target[tiled->building];
+  glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+  glViewport(0, 0, target->width, target->height);
+
+  // Every slice of the frame sees the same time, input keeps updating
+  float time     = uniforms->time;
+  uniforms->time = tiled->frameTime;
+  glUseProgram(program);
+  shaderUniformsUpload(uniforms);
+  shaderUserUniformsUpload(uniforms);
+  uniforms->time = time;
+
+  int measure = !tiled->queryPending;
+  if (measure) glBeginQuery(GL_TIME_ELAPSED, tiled->query);
+
+  glEnable(GL_SCISSOR_TEST);
+  glBindVertexArray(vao);
+  for (int i = 0; i < count; i++, tiled->next++) {
+    int tx = tiled->next % tiled->grid;
+    int ty = tiled->next / tiled->grid;
+    int x0 = target->width * tx / tiled->grid;
+    int y0 = target->height * ty / tiled->grid;
+    int x1 = target->width * (tx + 1) / tiled->grid;
+    int y1 = target->height * (ty + 1) / tiled->grid;
+    glScissor(x0, y0, x1 - x0, y1 - y0);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+  }
+  glDisable(GL_SCISSOR_TEST);
+
+  if (measure) {
+    glEndQuery(GL_TIME_ELAPSED);
+    tiled->queryPending = 1;
+    tiled->queryTiles   = count;
+  }
+  tiled->lastSliceTiles = count;
+
+  if (tiled->next < total) return 0;
+
+  tiled->inProgress   = 0;
+  tiled->hasCompleted = 1;
+  tiled->building     = !tiled->building;
+  tiled->frames++;
+  return 1;
+}
+
+struct glFrameBuffer* tiledRendererCompleted(struct TiledRenderer* tiled) {
+  return tiled->hasCompleted ? &tiled->target[!tiled->building] : NULL;
+}
+
+//=========================================================[LOOP CACHE]==================================================
+
+// Programs periodic in iTime can be baked once into a zlib compressed frame cache on disk and replayed from a
+// texture array. When the whole loop does not fit the memory budget frames are streamed from the mapped file.
+struct LoopCacheHeader {
+  char     magic[8];
+  uint32_t width;
+  uint32_t height;
+  uint32_t frameCount;
+  uint32_t fps;
+};
+
+struct LoopCacheFrame {
+  uint64_t offset;
+  uint64_t size;
+};
+
+const char* loopPresentSource =
+  "#version 330 core\n"
+  "uniform sampler2DArray iFrames;\n"
+  "uniform float iLayer;\n"
+  "in vec2 fUV;\n"
+  "out vec4 color;\n"
+  "void main() {\n"
+  "  color = texture(iFrames, vec3(fUV, iLayer));\n"
+  "}\n";
+
+enum LoopCacheState { LOOP_CACHE_IDLE, LOOP_CACHE_BAKING, LOOP_CACHE_LOADING };
+
+struct LoopCache {
+  float  period; // Seconds, 0 disables the loop cache
+  int    fps;
+  size_t budget; // Bytes of texture memory the loop may use
+  int    ready;
+  int    failed; // The program can not be baked, always render live
+  int    resident;
+  int    uploaded; // Layers of a resident loop uploaded so far
+  int    streamedFrame;
+  int    screenWidth; // Output size the loop was prepared for
+  int    screenHeight;
+
+  uint64_t  sourceHash;
+  uint64_t  uniformHash; // User uniform values the loop was baked with
+  long long diskLimit; // Bytes of baked loops kept in the cache directory
+
+  char                   path[MAX_LINE_LENGTH]; // Loop file of the current key, empty when none is prepared
+  struct LoopCacheHeader header;
+  struct LoopCacheFrame* frames;
+  unsigned char*         file;
+  size_t                 fileSize;
+  GLuint                 texture;
+  GLuint                 program;
+
+  // Baking renders one frame per draw and reads it back through a pixel buffer, the worker compresses and writes it
+  FILE*                  bakeFile;
+  struct LoopCacheFrame* bakeFrames;
+  uint64_t               bakeOffset;
+  int                    bakeNext; // Next frame rendered
+  int                    bakeRead; // Next frame collected from its pixel buffer
+  int                    bakeWritten;
+  long long              bakeBegin;
+  GLuint                 pbo[2];
+
+  // Frames pass between the render thread and the worker through a ring of preallocated frame buffers, raw frames
+  // to compress while baking and decompressed frames ahead of the presented one while loading
+  pthread_t       thread;
+  pthread_mutex_t lock;
+  pthread_cond_t  wake;
+  int             running;
+  int             quit;
+  int             state;
+  int             busy;       // The worker is working on a frame outside the lock
+  int             generation; // Bumped when the ring is flushed, the frame the worker is decoding is then dropped
+  int             corrupt;    // A frame failed to compress, write or decompress
+  int             decodeNext;
+  unsigned char*  ring[LOOP_RING_SIZE];
+  int             ringFrame[LOOP_RING_SIZE];
+  int             ringHead;
+  int             ringCount;
+};
+
+int loopCacheDecompress(struct LoopCache* loop, int frame, unsigned char* pixels) {
+  uLongf expected = (uLongf)loop->header.width * loop->header.height * 4;
+  uLongf size     = expected;
+  return uncompress(pixels, &size, loop->file + loop->frames[frame].offset, loop->frames[frame].size) != Z_OK || size != expected;
+}
+
+void* loopCacheWorker(void* arg) {
+  struct LoopCache* loop      = arg;
+  unsigned char*    packed    = NULL;
+  uLongf            packedMax = 0;
+
+  pthread_mutex_lock(&loop->lock);
+  while (!loop->quit) {
+    size_t frameSize = (size_t)loop->header.width * loop->header.height * 4;
+    if (loop->state == LOOP_CACHE_BAKING && loop->ringCount && !loop->corrupt) {
+      int slot   = loop->ringHead;
+      int frame  = loop->ringFrame[slot];
+      loop->busy = 1;
+      pthread_mutex_unlock(&loop->lock);
+
+      uLongf bound = compressBound(frameSize);
+      if (bound > packedMax) {
+        packed    = realloc(packed, bound);
+        packedMax = bound;
+      }
+      uLongf size   = bound;
+      int    failed = compress2(packed, &size, loop->ring[slot], frameSize, Z_BEST_SPEED) != Z_OK ||
+                   fwrite(packed, 1, size, loop->bakeFile) != size;
+      loop->bakeFrames[frame].offset = loop->bakeOffset;
+      loop->bakeFrames[frame].size   = size;
+      loop->bakeOffset += size;
+
+      pthread_mutex_lock(&loop->lock);
+      loop->ringHead = (slot + 1) % LOOP_RING_SIZE;
+      loop->ringCount--;
+      loop->bakeWritten++;
+      loop->corrupt |= failed;
+    } else if (loop->state == LOOP_CACHE_LOADING && loop->ringCount < LOOP_RING_SIZE && !loop->corrupt &&
+               loop->decodeNext < (int)loop->header.frameCount) {
+      int slot       = (loop->ringHead + loop->ringCount) % LOOP_RING_SIZE;
+      int frame      = loop->decodeNext;
+      int generation = loop->generation;
+      loop->busy     = 1;
+      pthread_mutex_unlock(&loop->lock);
+
+      int failed = loopCacheDecompress(loop, frame, loop->ring[slot]);
+
+      pthread_mutex_lock(&loop->lock);
+      if (generation == loop->generation) {
+        loop->ringFrame[slot] = frame;
+        loop->ringCount++;
+        loop->decodeNext = loop->resident ? frame + 1 : (frame + 1) % (int)loop->header.frameCount; // Streaming wraps around
+        loop->corrupt |= failed;
+      }
+    } else {
+      pthread_cond_wait(&loop->wake, &loop->lock);
+      continue;
+    }
+    loop->busy = 0;
+    pthread_cond_broadcast(&loop->wake);
+  }
+  pthread_mutex_unlock(&loop->lock);
+  free(packed);
+  return NULL;
+}
+
+void loopCacheCreate(struct LoopCache* loop, float period, int fps, int budgetMB, int diskLimitMB) {
+  memset(loop, 0, sizeof(*loop));
+  loop->period        = period;
+  loop->fps           = fps > 0 ? fps : DEFAULT_LOOP_FPS;
+  loop->budget        = (size_t)budgetMB * 1024 * 1024;
+  loop->diskLimit     = (long long)diskLimitMB * 1000000LL;
+  loop->streamedFrame = -1;
+  if (period <= 0.0f) return;
+
+  pthread_mutex_init(&loop->lock, NULL);
+  pthread_cond_init(&loop->wake, NULL);
+  if (pthread_create(&loop->thread, NULL, loopCacheWorker, loop)) {
+    fprintf(stderr, "[ERR] Cannot start the loop cache thread, loop cache disabled\n");
+    loop->failed = 1;
+    return;
+  }
+  loop->running = 1;
+}
+
+//Hands the ring to the worker for state, allocating its frame buffers for the current header
+void loopCacheStart(struct LoopCache* loop, int state) {
+  size_t frameSize = (size_t)loop->header.width * loop->header.height * 4;
+  for (int i = 0; i < LOOP_RING_SIZE; i++)
+    if (!loop->ring[i]) loop->ring[i] = malloc(frameSize);
+
+  pthread_mutex_lock(&loop->lock);
+  loop->ringHead   = 0;
+  loop->ringCount  = 0;
+  loop->decodeNext = 0;
+  loop->corrupt    = 0;
+  loop->state      = state;
+  pthread_cond_broadcast(&loop->wake);
+  pthread_mutex_unlock(&loop->lock);
+}
+
+//Takes the ring back from the worker, waiting for the frame it is working on
+void loopCacheStop(struct LoopCache* loop) {
+  if (!loop->running) return;
+  pthread_mutex_lock(&loop->lock);
+  loop->state = LOOP_CACHE_IDLE;
+  loop->generation++;
+  while (loop->busy) pthread_cond_wait(&loop->wake, &loop->lock);
+  pthread_mutex_unlock(&loop->lock);
+}
+
+void loopCacheRelease(struct LoopCache* loop) {
+  loopCacheStop(loop);
+  if (loop->bakeFile) { // Interrupted bake
+    char tmpPath[MAX_LINE_LENGTH + 4];
+    snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", loop->path);
+    fclose(loop->bakeFile);
+    unlink(tmpPath);
+  }
+  if (loop->pbo[0]) glDeleteBuffers(2, loop->pbo);
+  if (loop->file) munmap(loop->file, loop->fileSize);
+  if (loop->texture) glDeleteTextures(1, &loop->texture);
+  for (int i = 0; i < LOOP_RING_SIZE; i++) {
+    free(loop->ring[i]);
+    loop->ring[i] = NULL;
+  }
+  free(loop->bakeFrames);
+  loop->bakeFile      = NULL;
+  loop->bakeFrames    = NULL;
+  loop->pbo[0]        = 0;
+  loop->pbo[1]        = 0;
+  loop->file          = NULL;
+  loop->texture       = 0;
+  loop->path[0]       = 0;
+  loop->ready         = 0;
+  loop->uploaded      = 0;
+  loop->streamedFrame = -1;
+}
+
+void loopCacheDispose(struct LoopCache* loop) {
+  loopCacheRelease(loop);
+  if (loop->program) glDeleteProgram(loop->program);
+  if (loop->running) {
+    pthread_mutex_lock(&loop->lock);
+    loop->quit = 1;
+    pthread_cond_broadcast(&loop->wake);
+    pthread_mutex_unlock(&loop->lock);
+    pthread_join(loop->thread, NULL);
+    pthread_mutex_destroy(&loop->lock);
+    pthread_cond_destroy(&loop->wake);
+    loop->running = 0;
+  }
+}
+
+//Opens path.tmp and starts a background bake of every frame of the loop at width x height
+int loopCacheBakeBegin(struct LoopCache* loop, int width, int height) {
+  int    frameCount = (int)(loop->period * loop->fps + 0.5f);
+  size_t frameSize  = (size_t)width * height * 4;
+  if (frameCount < 1 || frameCount > LOOP_MAX_FRAMES) {
+    fprintf(stderr, "[ERR] Loop of %d frames not supported (max %d)\n", frameCount, LOOP_MAX_FRAMES);
+    return 1;
+  }
+
+  char tmpPath[MAX_LINE_LENGTH + 4];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", loop->path);
+  loop->bakeFile = fopen(tmpPath, "wb");
+  if (!loop->bakeFile) {
+    fprintf(stderr, "[ERR] Cannot write loop cache %s\n", tmpPath);
+    return 1;
+  }
+
+  struct LoopCacheHeader header = {"SPLOOP1", width, height, frameCount, loop->fps};
+  loop->header                  = header;
+  loop->bakeFrames              = calloc(frameCount, sizeof(struct LoopCacheFrame));
+  loop->bakeOffset              = sizeof(header) + frameCount * sizeof(struct LoopCacheFrame);
+  loop->bakeNext                = 0;
+  loop->bakeRead                = 0;
+  loop->bakeWritten             = 0;
+  loop->bakeBegin               = monotonicNow();
+  fwrite(&header, sizeof(header), 1, loop->bakeFile);
+  fwrite(loop->bakeFrames, sizeof(struct LoopCacheFrame), frameCount, loop->bakeFile);
+
+  glGenBuffers(2, loop->pbo);
+  for (int i = 0; i < 2; i++) {
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, loop->pbo[i]);
+    glBufferData(GL_PIXEL_PACK_BUFFER, frameSize, NULL, GL_STREAM_READ);
+  }
+  glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+
+  loopCacheStart(loop, LOOP_CACHE_BAKING);
+  fprintf(stderr, "[LOOP] Baking %d frames at %dx%d, rendering live meanwhile\n", frameCount, width, height);
+  return 0;
+}
+
+//Collects the frame read back on the previous draw and renders the next one into a pooled target.
+//Returns -1 on failure, 1 once the worker has written every frame
+int loopCacheBakeStep(struct LoopCache* loop, GLuint program, struct ShaderUniforms* uniforms, GLuint vao, int screenWidth, int screenHeight) {
+  int    width      = loop->header.width;
+  int    height     = loop->header.height;
+  int    frameCount = loop->header.frameCount;
+  size_t frameSize  = (size_t)width * height * 4;
+
+  if (loop->bakeRead < loop->bakeNext) {
+    pthread_mutex_lock(&loop->lock);
+    int slot = loop->ringCount < LOOP_RING_SIZE ? (loop->ringHead + loop->ringCount) % LOOP_RING_SIZE : -1;
+    pthread_mutex_unlock(&loop->lock);
+
+    if (slot != -1) { // Otherwise the worker is behind, the readback waits in its buffer
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, loop->pbo[loop->bakeRead % 2]);
+      void* pixels = glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0, frameSize, GL_MAP_READ_BIT);
+      if (pixels) memcpy(loop->ring[slot], pixels, frameSize);
+      glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+      glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+      if (!pixels) return -1;
+
+      pthread_mutex_lock(&loop->lock);
+      loop->ringFrame[slot] = loop->bakeRead++;
+      loop->ringCount++;
+      pthread_cond_broadcast(&loop->wake);
+      pthread_mutex_unlock(&loop->lock);
+    }
+  }
+
+  // At most one frame waits in each pixel buffer
+  if (loop->bakeNext < frameCount && loop->bakeNext - loop->bakeRead < 2) {
+    struct glFrameBuffer* target = renderTargetAcquire(&renderTargetPool, glFrameBufferColor(width, height, GL_RGBA8));
+    if (!target) return -1;
+
+    float time     = uniforms->time;
+    uniforms->time = (float)loop->bakeNext / loop->fps;
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glViewport(0, 0, width, height);
+    glUseProgram(program);
+    shaderUniformsUpload(uniforms);
+    shaderUserUniformsUpload(uniforms);
+    glBindVertexArray(vao);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    uniforms->time = time;
+
+    glPixelStorei(GL_PACK_ALIGNMENT, 1);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, loop->pbo[loop->bakeNext % 2]);
+    glReadPixels(0, 0, width, height, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+    glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+    renderTargetRelease(&renderTargetPool, target);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glViewport(0, 0, screenWidth, screenHeight);
+    loop->bakeNext++;
+  }
+
+  pthread_mutex_lock(&loop->lock);
+  int written = loop->bakeWritten;
+  int corrupt = loop->corrupt;
+  pthread_mutex_unlock(&loop->lock);
+  return corrupt ? -1 : written == frameCount;
+}
+
+//Writes the frame table of a completed bake and moves the file in place
+int loopCacheBakeFinish(struct LoopCache* loop) {
+  char tmpPath[MAX_LINE_LENGTH + 4];
+  snprintf(tmpPath, sizeof(tmpPath), "%s.tmp", loop->path);
+  loopCacheStop(loop);
+
+  fseek(loop->bakeFile, sizeof(loop->header), SEEK_SET);
+  fwrite(loop->bakeFrames, sizeof(struct LoopCacheFrame), loop->header.frameCount, loop->bakeFile);
+  int failed = ferror(loop->bakeFile);
+  failed |= fclose(loop->bakeFile);
+  loop->bakeFile = NULL;
+  glDeleteBuffers(2, loop->pbo);
+  loop->pbo[0] = 0;
+  loop->pbo[1] = 0;
+
+  if (failed || rename(tmpPath, loop->path)) {
+    fprintf(stderr, "[ERR] Failed writing loop cache %s\n", loop->path);
+    unlink(tmpPath);
+    return 1;
+  }
+
+  fprintf(stderr, "[LOOP] Baked %u frames in %.2fs, %.1f MB on disk (%.1f MB raw)\n", loop->header.frameCount,
+          (monotonicNow() - loop->bakeBegin) / 1e9, loop->bakeOffset / 1e6,
+          (double)loop->header.width * loop->header.height * 4 * loop->header.frameCount / 1e6);
+  int evicted = cacheDirectoryTrim("loops", ".loop", loop->diskLimit); // Loops of older sizes and uniform values
+  if (evicted) fprintf(stderr, "[LOOP] Removed %d old loops from the cache\n", evicted);
+  return 0;
+}
+
+//Checks the header against the expected output size and every frame against the file bounds
+int loopCacheValid(struct LoopCache* loop, int width, int height) {
+  uint64_t table = sizeof(loop->header) + (uint64_t)loop->header.frameCount * sizeof(struct LoopCacheFrame);
+  if (memcmp(loop->header.magic, "SPLOOP1", 8) || loop->header.width != (uint32_t)width || loop->header.height != (uint32_t)height ||
+      loop->header.frameCount == 0 || loop->header.frameCount > LOOP_MAX_FRAMES || loop->header.fps == 0 || table > loop->fileSize)
+    return 0;
+
+  for (uint32_t i = 0; i < loop->header.frameCount; i++) {
+    struct LoopCacheFrame* frame = &loop->frames[i];
+    if (frame->offset < table || frame->offset > loop->fileSize || frame->size > loop->fileSize - frame->offset) return 0;
+  }
+  return 1;
+}
+
+//Maps the cache file and allocates a texture array for the whole loop, or a single layer when it is over budget.
+//The worker then decompresses frames ahead of the draws uploading them.
+//Fails on files that do not match width x height or are truncated, the caller removes them
+int loopCacheLoad(struct LoopCache* loop, int width, int height) {
+  int fd = open(loop->path, O_RDONLY);
+  if (fd == -1) return 1;
+
+  struct stat st;
+  if (fstat(fd, &st) || st.st_size < (off_t)sizeof(loop->header)) {
+    fprintf(stderr, "[ERR] Invalid loop cache %s\n", loop->path);
+    close(fd);
+    return 1;
+  }
+  futimens(fd, NULL); // Recently used, kept longest by cacheDirectoryTrim
+  loop->fileSize = st.st_size;
+  loop->file     = mmap(NULL, loop->fileSize, PROT_READ, MAP_PRIVATE, fd, 0);
+  close(fd);
+  if (loop->file == MAP_FAILED) {
+    loop->file = NULL;
+    return 1;
+  }
+
+  memcpy(&loop->header, loop->file, sizeof(loop->header));
+  loop->frames = (struct LoopCacheFrame*)(loop->file + sizeof(loop->header));
+  if (!loopCacheValid(loop, width, height)) {
+    fprintf(stderr, "[ERR] Invalid loop cache %s\n", loop->path);
+    return 1;
+  }
+
+  size_t frameSize = (size_t)loop->header.width * loop->header.height * 4;
+  loop->resident   = frameSize * loop->header.frameCount <= loop->budget;
+
+  glGenTextures(1, &loop->texture);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, loop->texture);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+  glTexParameteri(GL_TEXTURE_2D_ARRAY, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+  glTexImage3D(GL_TEXTURE_2D_ARRAY, 0, GL_RGBA8, loop->header.width, loop->header.height,
+               loop->resident ? loop->header.frameCount : 1, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  loopCacheStart(loop, LOOP_CACHE_LOADING);
+  fprintf(stderr, "[LOOP] Loading %u frames %s (%.1f MB)\n", loop->header.frameCount,
+          loop->resident ? "into a texture array" : "for streaming", frameSize * (loop->resident ? loop->header.frameCount : 1) / 1e6);
+  return 0;
+}
+
+//Uploads the frames decompressed since the last draw into their layers, the loop is ready once all are in
+void loopCacheUploadResident(struct LoopCache* loop) {
+  pthread_mutex_lock(&loop->lock);
+  int head  = loop->ringHead;
+  int count = loop->ringCount;
+  pthread_mutex_unlock(&loop->lock);
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, loop->texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  for (int i = 0; i < count; i++) {
+    int slot = (head + i) % LOOP_RING_SIZE;
+    glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, loop->ringFrame[slot], loop->header.width, loop->header.height, 1,
+                    GL_RGBA, GL_UNSIGNED_BYTE, loop->ring[slot]);
+  }
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  pthread_mutex_lock(&loop->lock);
+  loop->ringHead = (head + count) % LOOP_RING_SIZE;
+  loop->ringCount -= count;
+  pthread_cond_broadcast(&loop->wake);
+  pthread_mutex_unlock(&loop->lock);
+
+  loop->uploaded += count;
+  if (loop->uploaded < (int)loop->header.frameCount) return;
+  loopCacheStop(loop);
+  munmap(loop->file, loop->fileSize);
+  loop->file = NULL;
+  for (int i = 0; i < LOOP_RING_SIZE; i++) {
+    free(loop->ring[i]);
+    loop->ring[i] = NULL;
+  }
+  loop->ready = 1;
+  fprintf(stderr, "[LOOP] Loaded %u frames\n", loop->header.frameCount);
+}
+
+//Uploads frame into the single streamed layer once the worker has decompressed it. Frames the presentation skipped
+//are dropped, a frame far from the decoded ones restarts the worker there
+void loopCacheStream(struct LoopCache* loop, int frame) {
+  int frameCount = loop->header.frameCount;
+  if (frame == loop->streamedFrame) return;
+
+  pthread_mutex_lock(&loop->lock);
+  while (loop->ringCount && loop->ringFrame[loop->ringHead] != frame) {
+    loop->ringHead = (loop->ringHead + 1) % LOOP_RING_SIZE;
+    loop->ringCount--;
+  }
+  int slot = loop->ringCount ? loop->ringHead : -1;
+  if (slot == -1 && (frame - loop->decodeNext + frameCount) % frameCount >= LOOP_RING_SIZE) {
+    loop->decodeNext = frame;
+    loop->generation++;
+  }
+  pthread_cond_broadcast(&loop->wake);
+  pthread_mutex_unlock(&loop->lock);
+  if (slot == -1) return; // Not decompressed yet, the last streamed frame stays on screen
+
+  glBindTexture(GL_TEXTURE_2D_ARRAY, loop->texture);
+  glPixelStorei(GL_UNPACK_ALIGNMENT, 1);
+  glTexSubImage3D(GL_TEXTURE_2D_ARRAY, 0, 0, 0, 0, loop->header.width, loop->header.height, 1, GL_RGBA, GL_UNSIGNED_BYTE, loop->ring[slot]);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, 0);
+
+  pthread_mutex_lock(&loop->lock);
+  loop->ringHead = (slot + 1) % LOOP_RING_SIZE;
+  loop->ringCount--;
+  pthread_cond_broadcast(&loop->wake);
+  pthread_mutex_unlock(&loop->lock);
+  loop->streamedFrame = frame;
+}
+
+int loopCacheFrameAt(struct LoopCache* loop, float time) {
+  return (int)(fmodf(time, loop->period) * loop->header.fps) % loop->header.frameCount;
+}
+
+//Advances the bake or load in progress by one draw, failures disable the loop cache.
+//Returns whether the frame for time can be presented from the loop
+int loopCacheUpdate(struct LoopCache* loop, float time, GLuint program, struct ShaderUniforms* uniforms, GLuint vao, int screenWidth, int screenHeight) {
+  int failed = 0;
+  if (loop->bakeFile) {
+    int status = loopCacheBakeStep(loop, program, uniforms, vao, screenWidth, screenHeight);
+    if (status == 0) return 0;
+    failed = status == -1 || loopCacheBakeFinish(loop) || loopCacheLoad(loop, loop->header.width, loop->header.height);
+  }
+
+  pthread_mutex_lock(&loop->lock);
+  int corrupt = loop->corrupt;
+  pthread_mutex_unlock(&loop->lock);
+  if (!failed && corrupt) fprintf(stderr, "[ERR] Corrupted loop cache %s\n", loop->path);
+  if (failed || corrupt) {
+    unlink(loop->path); // Not written yet when the bake itself failed
+    loopCacheRelease(loop);
+    loop->failed = 1;
+    return 0;
+  }
+
+  if (loop->resident) {
+    if (!loop->ready) loopCacheUploadResident(loop);
+    return loop->ready;
+  }
+  loopCacheStream(loop, loopCacheFrameAt(loop, time));
+  return loop->streamedFrame >= 0;
+}
+
+void loopCachePresent(struct LoopCache* loop, float time, int width, int height, GLuint vao) {
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, width, height);
+  glUseProgram(loop->program);
+  glActiveTexture(GL_TEXTURE0);
+  glBindTexture(GL_TEXTURE_2D_ARRAY, loop->texture);
+  glUniform1i(glGetUniformLocation(loop->program, "iFrames"), 0);
+  glUniform1f(glGetUniformLocation(loop->program, "iLayer"), loop->resident ? loopCacheFrameAt(loop, time) : 0);
+  glBindVertexArray(vao);
+  glDrawArrays(GL_TRIANGLES, 0, 6);
+}
+
+//=========================================================[RENDER GRAPH]================================================
+
+//Shadertoy style buffer passes A-D drawn in order before the image pass. Each pass renders into the back target of
+//its ping-pong pair and then flips it, so a pass reading a later buffer or itself samples the previous frame while
+//earlier buffers and the image pass see the frame just drawn.
+struct RenderPass {
+  GLuint                program;
+  struct ShaderUniforms uniforms;
+  struct glFrameBuffer  target[2];
+  int                   current;   // Target holding the last completed frame
+  int                   history;   // Read by itself or an earlier pass, otherwise only needed until the image pass
+  struct glFrameBuffer* transient; // Pooled target of a pass without history for the current frame
+  int                   lastReader; // Pass after which the transient target goes back to the pool
+};
+
+struct RenderGraph {
+  struct RenderPass    passes[MAX_CHANNELS];
+  struct glTexturePack textures;
+  int                  textureSlot[RENDER_PASS_COUNT][MAX_CHANNELS]; // Index into textures for texture inputs, -1 otherwise
+  int                  passCount;
+};
+
+//Returns the buffer pass a channel value names, -1 for texture paths
+int renderGraphBufferIndex(const char* channel) {
+  if (channel[0] >= 'A' && channel[0] <= 'D' && channel[1] == 0) return channel[0] - 'A';
+  return -1;
+}
+
+int renderGraphCreate(struct RenderGraph* graph, struct SessionConfiguration* config) {
+  char* texturePaths[MAX_TEXTURE_SLOTS];
+  int   textureCount = 0;
+
+  memset(graph, 0, sizeof(*graph));
+  for (int i = 0; i < RENDER_PASS_COUNT; i++) {
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      const char* channel      = config->passes[i].channel[c];
+      graph->textureSlot[i][c] = -1;
+      if (!config->passes[i].enabled || channel[0] == 0 || renderGraphBufferIndex(channel) != -1) continue;
+      if (textureCount == MAX_TEXTURE_SLOTS) {
+        fprintf(stderr, "[WARN] Too many pass textures, %s ignored\n", channel);
+        continue;
+      }
+      graph->textureSlot[i][c]     = textureCount;
+      texturePaths[textureCount++] = (char*)channel;
+    }
+  }
+  graph->textures = glTexturePackLoad(textureCount, texturePaths, 0, 0, RESAMPLE_NONE);
+
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    struct PassConfiguration* pass = &config->passes[i];
+    if (!pass->enabled) continue;
+
+    GLuint program = glProgramCompile(pass->fragmentShader, config->vertexShader, config->defines);
+    if (!program) {
+      fprintf(stderr, "[ERR] Pass %s: error compiling %s\n%s\n", renderPassNames[i], pass->fragmentShader, infolog);
+      continue;
+    }
+
+    struct ShaderUniforms* u = &graph->passes[i].uniforms;
+    graph->passes[i].program = program;
+    glUseProgram(program);
+    shaderUniformsInitLocations(u, program);
+    shaderUniformsFindUserDefined(u, program);
+    shaderUniformsApplyDefaults(u, config);
+    graph->passCount++;
+  }
+
+  // A buffer read by itself or by an earlier pass has to survive until the next frame, any other buffer only until
+  // its last reader in this frame was drawn
+  for (int i = 0; i < MAX_CHANNELS; i++) graph->passes[i].lastReader = i;
+  for (int reader = 0; reader < RENDER_PASS_COUNT; reader++) {
+    if (reader != RENDER_PASS_IMAGE && !graph->passes[reader].program) continue;
+    for (int c = 0; c < MAX_CHANNELS; c++) {
+      int buffer = renderGraphBufferIndex(config->passes[reader].channel[c]);
+      if (buffer == -1) continue;
+      if (buffer >= reader) graph->passes[buffer].history = 1;
+      if (reader > graph->passes[buffer].lastReader) graph->passes[buffer].lastReader = reader;
+    }
+  }
+
+  if (graph->passCount) fprintf(stderr, "[OK] Render graph with %d buffer passes\n", graph->passCount);
+  return 0;
+}
+
+void renderGraphDispose(struct RenderGraph* graph) {
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    struct RenderPass* pass = &graph->passes[i];
+    glDeleteProgram(pass->program);
+    for (int j = 0; j < pass->uniforms.hintUniformsCount; j++) free(pass->uniforms.hintUniformsName[j]);
+    for (int j = 0; j < 2; j++)
+      if (pass->target[j].fbo) glFrameBufferDispose(&pass->target[j]);
+  }
+  glTexturePackDispose(&graph->textures);
+  memset(graph, 0, sizeof(*graph));
+}
+
+//Binds the inputs of a pass to the iChannel slots of its uniforms
+void renderGraphBindChannels(struct RenderGraph* graph, struct SessionConfiguration* config, int pass, struct ShaderUniforms* u) {
+  for (int c = 0; c < MAX_CHANNELS; c++) {
+    GLuint id     = 0;
+    int    width  = 0;
+    int    height = 0;
+    int    buffer = renderGraphBufferIndex(config->passes[pass].channel[c]);
+    int    slot   = graph->textureSlot[pass][c];
+
+    struct RenderPass* source = buffer != -1 ? &graph->passes[buffer] : NULL;
+    if (source && source->program && (source->history || source->transient)) {
+      struct glFrameBuffer* target = source->history ? &source->target[source->current] : source->transient;
+      id                           = target->rt[0];
+      width                        = target->width;
+      height                       = target->height;
+    } else if (slot != -1) {
+      id     = graph->textures.textures[slot].id;
+      width  = graph->textures.textures[slot].width;
+      height = graph->textures.textures[slot].height;
+    }
+
+    u->channelTexturesId[c]    = id;
+    u->channelResolution[c][0] = width;
+    u->channelResolution[c][1] = height;
+    u->channelResolution[c][2] = 1.0f;
+  }
+}
+
+//Creates or resizes both targets of a pass, clearing them so feedback starts from black
+void renderGraphPrepare(struct RenderPass* pass, GLenum format, int width, int height) {
+  if (pass->target[0].fbo && pass->target[0].width == width && pass->target[0].height == height) return;
+
+  for (int i = 0; i < 2; i++) {
+    if (pass->target[i].fbo) glFrameBufferResize(&pass->target[i], width, height);
+    else glFrameBufferCreate(&pass->target[i], glFrameBufferColor(width, height, format));
+
+    glBindFramebuffer(GL_FRAMEBUFFER, pass->target[i].fbo);
+    glClearColor(0.0f, 0.0f, 0.0f, 0.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+  }
+}
+
+//Draws every buffer pass for the current frame, leaving the default framebuffer bound
+void renderGraphExecute(struct RenderGraph* graph, struct SessionConfiguration* config, struct ShaderUniforms* uniforms, int screenWidth, int screenHeight, GLuint vao) {
+  glBindVertexArray(vao);
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    struct RenderPass* pass = &graph->passes[i];
+    if (!pass->program) continue;
+
+    int width  = (int)(screenWidth * config->passes[i].scale + 0.5f);
+    int height = (int)(screenHeight * config->passes[i].scale + 0.5f);
+    if (width < 1) width = 1;
+    if (height < 1) height = 1;
+    struct glFrameBuffer* target;
+    if (pass->history) {
+      renderGraphPrepare(pass, config->passes[i].format, width, height);
+      target = &pass->target[!pass->current];
+    } else {
+      target = pass->transient = renderTargetAcquire(&renderTargetPool, glFrameBufferColor(width, height, config->passes[i].format));
+      if (!target) continue;
+    }
+
+    memcpy(&pass->uniforms, uniforms, offsetof(struct ShaderUniforms, iQuality));
+    pass->uniforms.width  = width;
+    pass->uniforms.height = height;
+    renderGraphBindChannels(graph, config, i, &pass->uniforms);
+
+    glBindFramebuffer(GL_FRAMEBUFFER, target->fbo);
+    glViewport(0, 0, width, height);
+    glUseProgram(pass->program);
+    shaderUniformsUpload(&pass->uniforms);
+    shaderUserUniformsUpload(&pass->uniforms);
+    glDrawArrays(GL_TRIANGLES, 0, 6);
+    if (pass->history) pass->current = !pass->current;
+
+    // Buffers nobody reads after this pass, later passes can reuse their targets
+    for (int j = 0; j <= i; j++) {
+      if (graph->passes[j].lastReader != i || !graph->passes[j].transient) continue;
+      renderTargetRelease(&renderTargetPool, graph->passes[j].transient);
+      graph->passes[j].transient = NULL;
+    }
+  }
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, screenWidth, screenHeight);
+}
+
+//Hands the targets of the passes the image pass reads back to the pool once it was drawn
+void renderGraphRelease(struct RenderGraph* graph) {
+  for (int i = 0; i < MAX_CHANNELS; i++) {
+    renderTargetRelease(&renderTargetPool, graph->passes[i].transient);
+    graph->passes[i].transient = NULL;
+  }
+}
+
+//=========================================================[HOT RELOAD]==================================================
+
+GLXFBConfig glxChooseConfig(Display* dpy, int screen, int drawableBit);
+GLXContext  glxCreateContext(Display* dpy, GLXFBConfig fbConfig, GLXContext share);
+
+enum ReloadStatus {
+  RELOAD_IDLE = 0,
+  RELOAD_COMPILING,
+  RELOAD_READY,
+  RELOAD_FAILED
+};
+
+struct WatchedFile {
+  int  wd;
+  char name[MAX_LINE_LENGTH]; // Basename inside the watched directory
+};
+
+struct CompileJob {
+  int               requested; // Not yet picked by the worker
+  enum ReloadStatus status;
+  char              fragmentShader[MAX_LINE_LENGTH];
+  char              vertexShader[MAX_LINE_LENGTH];
+  char              defines[MAX_DEFINES_LENGTH];
+  GLuint            program;
+  GLsync            fence;
+  char              log[MAX_LOG_SIZE];
+};
+
+// Shader files and the configuration are watched with inotify. Their parent directories are watched rather than the
+// files themselves so saves that replace the file through a rename are seen too. Programs are compiled on a worker
+// thread owning a GLX context that shares objects with the render context; the render loop picks the result up once
+// its fence is signaled and never waits for a compile. The worker also builds the quality tier variants.
+struct ShaderReloader {
+  Display*   dpy;
+  GLXContext context;
+  GLXPbuffer pbuffer;
+  pthread_t  thread;
+  int        running;
+
+  int                inotifyfd;
+  int                eventfd; // Signaled by the worker when a compile finished
+  struct WatchedFile watched[MAX_WATCHED_FILES];
+  int                watchedCount;
+  int                configWatch; // Index of the configuration file in watched
+
+  pthread_mutex_t   lock;
+  pthread_cond_t    wake;
+  int               quit;
+  struct CompileJob jobs[MAX_QUALITY_TIERS + 1]; // One slot per quality tier, the last tier is the base program
+};
+
+void* shaderReloaderWorker(void* arg) {
+  struct ShaderReloader* reloader = arg;
+  glXMakeContextCurrent(reloader->dpy, reloader->pbuffer, reloader->pbuffer, reloader->context);
+
+  pthread_mutex_lock(&reloader->lock);
+  while (!reloader->quit) {
+    struct CompileJob* job = NULL;
+    for (int i = MAX_QUALITY_TIERS; i >= 0 && !job; i--)
+      if (reloader->jobs[i].requested) job = &reloader->jobs[i];
+    if (!job) {
+      pthread_cond_wait(&reloader->wake, &reloader->lock);
+      continue;
+    }
+
+    char fragmentShader[MAX_LINE_LENGTH], vertexShader[MAX_LINE_LENGTH], defines[MAX_DEFINES_LENGTH];
+    memcpy(fragmentShader, job->fragmentShader, MAX_LINE_LENGTH);
+    memcpy(vertexShader, job->vertexShader, MAX_LINE_LENGTH);
+    memcpy(defines, job->defines, MAX_DEFINES_LENGTH);
+    job->requested = 0;
+    pthread_mutex_unlock(&reloader->lock);
+
+    infolog[0]     = 0;
+    GLuint program = glProgramCompile(fragmentShader, vertexShader, defines);
+    GLsync fence   = program ? glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0) : 0;
+    glFlush();
+
+    pthread_mutex_lock(&reloader->lock);
+    //A newer request supersedes this result
+    if (job->requested) {
+      if (fence) glDeleteSync(fence);
+      if (program) glDeleteProgram(program);
+      continue;
+    }
+    if (job->program) glDeleteProgram(job->program);
+    if (job->fence) glDeleteSync(job->fence);
+    job->program = program;
+    job->fence   = fence;
+    job->status  = program ? RELOAD_READY : RELOAD_FAILED;
+    snprintf(job->log, sizeof(job->log), "%s", infolog[0] ? infolog : "Shader file not found");
+
+    uint64_t one = 1;
+    if (write(reloader->eventfd, &one, sizeof(one)) < 0) perror("[ERR] eventfd write");
+  }
+  pthread_mutex_unlock(&reloader->lock);
+
+  glXMakeContextCurrent(reloader->dpy, None, None, NULL);
+  return NULL;
+}
+
+void shaderReloaderWatch(struct ShaderReloader* reloader, const char* file) {
+  char* path = findfile(file);
+  if (!path || reloader->watchedCount == MAX_WATCHED_FILES) {
+    free(path);
+    return;
+  }
+
+  struct WatchedFile* watched = &reloader->watched[reloader->watchedCount];
+  char*               slash   = strrchr(path, '/');
+  const char*         dir     = ".";
+  if (slash) {
+    *slash = 0;
+    dir    = slash == path ? "/" : path;
+  }
+  snprintf(watched->name, sizeof(watched->name), "%s", slash ? slash + 1 : path);
+
+  watched->wd = inotify_add_watch(reloader->inotifyfd, dir, IN_CLOSE_WRITE | IN_MOVED_TO | IN_CREATE);
+  if (watched->wd == -1) fprintf(stderr, "[WARN] Cannot watch %s for changes\n", file);
+  else
+    reloader->watchedCount++;
+  free(path);
+}
+
+//(Re)installs the watches on the configuration file, the shaders it references and the files they include
+void shaderReloaderWatchAll(struct ShaderReloader* reloader, const char* configfile, struct SessionConfiguration* config) {
+  for (int i = 0; i < reloader->watchedCount; i++)
+    inotify_rm_watch(reloader->inotifyfd, reloader->watched[i].wd);
+  reloader->watchedCount = 0;
+
+  reloader->configWatch = 0;
+  shaderReloaderWatch(reloader, configfile);
+  if (reloader->watchedCount == 0) reloader->configWatch = -1;
+
+  const char* shaders[] = {config->vertexShader, config->fragmentShader};
+  for (int i = 0; i < 2; i++) {
+    char dependencies[MAX_SHADER_DEPENDENCIES][MAX_LINE_LENGTH];
+    int  count = glslDependencies(shaders[i], config->defines, dependencies, MAX_SHADER_DEPENDENCIES);
+    if (count == 0) shaderReloaderWatch(reloader, shaders[i]);
+    for (int j = 0; j < count; j++) shaderReloaderWatch(reloader, dependencies[j]);
+  }
+}
+
+int shaderReloaderCreate(struct ShaderReloader* reloader, Display* dpy, const char* configfile, struct SessionConfiguration* config) {
+  memset(reloader, 0, sizeof(*reloader));
+  reloader->dpy       = dpy;
+  reloader->inotifyfd = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+  reloader->eventfd   = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+  if (reloader->inotifyfd == -1 || reloader->eventfd == -1) {
+    perror("[ERR] Hot reload disabled");
+    return 1;
+  }
+
+  GLXFBConfig fbConfig = glxChooseConfig(dpy, DefaultScreen(dpy), GLX_PBUFFER_BIT);
+  int         attribs[] = {GLX_PBUFFER_WIDTH, 1, GLX_PBUFFER_HEIGHT, 1, None};
+  if (fbConfig) {
+    reloader->context = glxCreateContext(dpy, fbConfig, glXGetCurrentContext());
+    reloader->pbuffer = glXCreatePbuffer(dpy, fbConfig, attribs);
+  }
+  if (!reloader->context || !reloader->pbuffer) {
+    fprintf(stderr, "[ERR] Cannot create a shared context, hot reload disabled\n");
+    return 1;
+  }
+
+  pthread_mutex_init(&reloader->lock, NULL);
+  pthread_cond_init(&reloader->wake, NULL);
+  if (pthread_create(&reloader->thread, NULL, shaderReloaderWorker, reloader)) {
+    fprintf(stderr, "[ERR] Cannot start the compile thread, hot reload disabled\n");
+    return 1;
+  }
+  reloader->running = 1;
+
+  shaderReloaderWatchAll(reloader, configfile, config);
+  fprintf(stderr, "[OK] Watching %d files for changes\n", reloader->watchedCount);
+  return 0;
+}
+
+void shaderReloaderDispose(struct ShaderReloader* reloader) {
+  if (reloader->running) {
+    pthread_mutex_lock(&reloader->lock);
+    reloader->quit = 1;
+    pthread_cond_signal(&reloader->wake);
+    pthread_mutex_unlock(&reloader->lock);
+    pthread_join(reloader->thread, NULL);
+
+    for (int i = 0; i <= MAX_QUALITY_TIERS; i++) {
+      if (reloader->jobs[i].program) glDeleteProgram(reloader->jobs[i].program);
+      if (reloader->jobs[i].fence) glDeleteSync(reloader->jobs[i].fence);
+    }
+    pthread_mutex_destroy(&reloader->lock);
+    pthread_cond_destroy(&reloader->wake);
+  }
+  if (reloader->pbuffer) glXDestroyPbuffer(reloader->dpy, reloader->pbuffer);
+  if (reloader->context) glXDestroyContext(reloader->dpy, reloader->context);
+  if (reloader->inotifyfd != -1) close(reloader->inotifyfd);
+  if (reloader->eventfd != -1) close(reloader->eventfd);
+}
+
+//Queues a compile of the configured program with the given #define block into slot
+void shaderReloaderRequest(struct ShaderReloader* reloader, int slot, struct SessionConfiguration* config, const char* defines) {
+  if (!reloader->running) return;
+  struct CompileJob* job = &reloader->jobs[slot];
+  pthread_mutex_lock(&reloader->lock);
+  memcpy(job->fragmentShader, config->fragmentShader, MAX_LINE_LENGTH);
+  memcpy(job->vertexShader, config->vertexShader, MAX_LINE_LENGTH);
+  snprintf(job->defines, MAX_DEFINES_LENGTH, "%s", defines);
+  job->requested = 1;
+  job->status    = RELOAD_COMPILING;
+  pthread_cond_signal(&reloader->wake);
+  pthread_mutex_unlock(&reloader->lock);
+}
+
+//Drains the inotify queue. Returns a bitmask, 1 when a shader changed and 2 when the configuration changed.
+int shaderReloaderChanges(struct ShaderReloader* reloader) {
+  if (!reloader->running) return 0;
+
+  char buffer[4096] __attribute__((aligned(__alignof__(struct inotify_event))));
+  int  changes = 0;
+  long length;
+
+  while ((length = read(reloader->inotifyfd, buffer, sizeof(buffer))) > 0) {
+    for (char* ptr = buffer; ptr < buffer + length;) {
+      struct inotify_event* event = (struct inotify_event*)ptr;
+      for (int i = 0; i < reloader->watchedCount; i++) {
+        if (event->wd == reloader->watched[i].wd && event->len && strcmp(event->name, reloader->watched[i].name) == 0)
+          changes |= i == reloader->configWatch ? 2 : 1;
+      }
+      ptr += sizeof(struct inotify_event) + event->len;
+    }
+  }
+  return changes;
+}
+
+//Returns a program once the worker finished it and its commands completed, 0 otherwise. The slot it was
+//requested for is stored in slot. On failure the compile log is copied to log and *failed is set.
+GLuint shaderReloaderPoll(struct ShaderReloader* reloader, int* slot, char* log, int* failed) {
+  *failed = 0;
+  if (!reloader->running) return 0;
+
+  uint64_t count;
+  if (read(reloader->eventfd, &count, sizeof(count)) < 0 && errno != EAGAIN) perror("[ERR] eventfd read");
+
+  GLuint program = 0;
+  pthread_mutex_lock(&reloader->lock);
+  for (int i = 0; i <= MAX_QUALITY_TIERS && !program && !*failed; i++) {
+    struct CompileJob* job = &reloader->jobs[i];
+    *slot                  = i;
+    if (job->status == RELOAD_FAILED) {
+      snprintf(log, MAX_LOG_SIZE, "%s", job->log);
+      job->status = RELOAD_IDLE;
+      *failed     = 1;
+    } else if (job->status == RELOAD_READY && glClientWaitSync(job->fence, 0, 0) != GL_TIMEOUT_EXPIRED) {
+      glDeleteSync(job->fence);
+      program      = job->program;
+      job->program = 0;
+      job->fence   = 0;
+      job->status  = RELOAD_IDLE;
+    }
+  }
+  pthread_mutex_unlock(&reloader->lock);
+  return program;
+}
+
+int shaderReloaderPending(struct ShaderReloader* reloader) {
+  if (!reloader->running) return 0;
+  int pending = 0;
+  pthread_mutex_lock(&reloader->lock);
+  for (int i = 0; i <= MAX_QUALITY_TIERS; i++) pending |= reloader->jobs[i].status != RELOAD_IDLE;
+  pthread_mutex_unlock(&reloader->lock);
+  return pending;
+}
+
 //=========================================================[SESSION]=====================================================
 
 struct ShaderSession {
-  GLuint                      shaderProgram;
+  GLuint                      shaderProgram; // Program of the active quality tier
+  GLuint                      programs[MAX_QUALITY_TIERS + 1];
   struct SessionConfiguration config;
   struct glMesh               quad;
   struct glMesh               cube;
-  struct glFrameBuffer        fbo;
+  struct glFrameBuffer*       fbo; // Pooled offscreen target, held between BeginFBO and EndFBO
   struct ShaderUniforms       uniforms;
   struct glTexturePack        usertextures;
-
-  int      screenWidth;
-  int      screenHeight;
-  int      fboWidth;
-  int      fboHeight;
-  GLTtext* errorText;
+  GLuint                      usertextureArray; // All user textures as layers, with texturearray=1
+  struct FramePacer           pacer;
+  struct OcclusionTracker     occlusion;
+  struct ResolutionGovernor   governor;
+  struct Upscaler             upscaler;
+  struct InterleaveState      interleave;
+  struct TiledRenderer        tiled;
+  struct LoopCache            loop;
+  struct RenderGraph          graph;
+  struct ShaderReloader       reloader;
+  struct ProgramBuild         build;
+  struct ProgramBuild         freezeBuild;
+  struct ShaderUniforms       frozenUniforms; // Locations in frozenProgram, data copied from uniforms every frame
+
+  const char* configPath;
+  int         displayWidth; // Size user textures are downscaled to, set before shaderSessionCreate
+  int         displayHeight;
+  int         screenWidth;
+  int         screenHeight;
+  int         fboWidth;
+  int         fboHeight;
+  int         onDemand; // Program uses no time or input, only redraw when dirty
+  int         dirty;
+  int         offscreen;    // Always render through the session FBO (benchmark mode)
+  int         reloadFailed; // The last hot reload failed, errorText is drawn over the previous program
+  int         tier;         // Active quality tier, config.tierCount is the base program
+  GLuint      frozenProgram; // Active program with user uniforms folded into constants
+  int         frozenCount;
+  uint64_t    frozenHash; // User uniform values frozenProgram was built with
+  uint64_t    freezeAttempt;
+  uint64_t    editHash; // Last seen user uniform values
+  long long   lastEdit;
+  GLTtext*    errorText;
 };
 
-int shaderSessionLoadProgram(struct ShaderSession* session) {
-  GLuint program = glProgramCompile(session->config.fragmentShader, session->config.vertexShader);
+void shaderSessionThaw(struct ShaderSession* session) {
+  if (!session->frozenProgram) return;
+  fprintf(stderr, "[FREEZE] Back to the generic program\n");
+  glDeleteProgram(session->frozenProgram);
+  session->frozenProgram = 0;
+  session->dirty         = 1;
+}
 
-  if (!program) {
+//Makes program current and reflects its uniforms, user uniform values of the previous program are kept by name
+void shaderSessionUseProgram(struct ShaderSession* session, GLuint program) {
+  struct ShaderUniforms* u = &session->uniforms;
+  int                    previousCount = u->hintUniformsCount;
+  char*                  previousName[MAX_HINT_UNIFORMS];
+  GLenum                 previousType[MAX_HINT_UNIFORMS];
+  union UniformValue     previousValue[MAX_HINT_UNIFORMS];
+  memcpy(previousName, u->hintUniformsName, sizeof(previousName));
+  memcpy(previousType, u->hintUniformsType, sizeof(previousType));
+  memcpy(previousValue, u->hintUniformsValue, sizeof(previousValue));
+
+  shaderSessionThaw(session);
+  session->shaderProgram = program;
+  glUseProgram(session->shaderProgram);
+
+  shaderUniformsInitLocations(u, session->shaderProgram);
+  shaderUniformsFindUserDefined(u, session->shaderProgram);
+  shaderUniformsApplyDefaults(u, &session->config);
+
+  for (int i = 0; i < u->hintUniformsCount; i++) {
+    for (int j = 0; j < previousCount; j++) {
+      if (previousType[j] == u->hintUniformsType[i] && strcmp(previousName[j], u->hintUniformsName[i]) == 0)
+        u->hintUniformsValue[i] = previousValue[j];
+    }
+  }
+  for (int j = 0; j < previousCount; j++) free(previousName[j]);
+
+  session->onDemand = !shaderUniformsIsAnimated(u) && !session->graph.passCount; // Buffer passes feed back every frame
+  session->dirty    = 1;
+  if (session->onDemand) fprintf(stderr, "[OK] Program uses no time or input, rendering on demand.\n");
+
+  shaderUniformsUpload(u);
+  shaderUserUniformsUpload(u);
+}
+
+//Stores the program built for a quality tier, making it current when that tier is active
+void shaderSessionSetProgram(struct ShaderSession* session, int tier, GLuint program) {
+  if (session->programs[tier]) glDeleteProgram(session->programs[tier]);
+  session->programs[tier] = program;
+  if (tier == session->tier) shaderSessionUseProgram(session, program);
+}
+
+//Switches to another quality tier once its variant finished building
+void shaderSessionSelectTier(struct ShaderSession* session, int tier) {
+  if (tier == session->tier || !session->programs[tier]) return;
+  fprintf(stderr, "[TIER] quality tier %d -> %d\n", session->tier, tier);
+  session->tier = tier;
+  shaderSessionUseProgram(session, session->programs[tier]);
+}
+
+const char* shaderSessionDefines(struct ShaderSession* session) {
+  return session->tier < session->config.tierCount ? session->config.tierDefines[session->tier] : session->config.defines;
+}
+
+//Starts building a variant of the active program with the current user uniform values as constants
+int shaderSessionFreeze(struct ShaderSession* session) {
+  if (!session->shaderProgram || glProgramBuildPending(&session->freezeBuild)) return 1;
+
+  char* fsource = glslPreprocess(session->config.fragmentShader, shaderSessionDefines(session));
+  char* vsource = glslPreprocess(session->config.vertexShader, shaderSessionDefines(session));
+  char* ffrozen = NULL;
+  char* vfrozen = NULL;
+  int   fcount = 0, vcount = 0;
+  if (fsource && vsource) {
+    ffrozen = glslFreezeUniforms(fsource, &session->uniforms, &fcount);
+    vfrozen = glslFreezeUniforms(vsource, &session->uniforms, &vcount);
+  }
+
+  if (fcount + vcount > 0) {
+    fprintf(stderr, "[FREEZE] Building program with %d constant uniforms\n", fcount + vcount);
+    session->frozenHash  = shaderUniformsHashUser(&session->uniforms);
+    session->frozenCount = fcount + vcount;
+    glProgramBuildStart(&session->freezeBuild, ffrozen, vfrozen, "frozen uniforms");
+  }
+  free(fsource);
+  free(vsource);
+  free(ffrozen);
+  free(vfrozen);
+  return fcount + vcount == 0;
+}
+
+//Tracks user uniform edits: thaws as soon as a value changes, freezes again (with the freeze flag) once
+//the values stayed the same for FREEZE_IDLE_TIME, and installs finished frozen programs
+void shaderSessionUpdateFreeze(struct ShaderSession* session) {
+  uint64_t  hash = shaderUniformsHashUser(&session->uniforms);
+  long long now  = monotonicNow();
+  if (hash != session->editHash) {
+    session->editHash = hash;
+    session->lastEdit = now;
+  }
+  if (session->frozenProgram && hash != session->frozenHash) shaderSessionThaw(session);
+
+  struct ProgramBuild* build = &session->freezeBuild;
+  if (glProgramBuildPending(build) && glProgramBuildPoll(build)) {
+    if (build->state == PROGRAM_BUILD_DONE && hash == session->frozenHash) {
+      shaderSessionThaw(session);
+      session->frozenProgram  = build->program;
+      session->frozenUniforms = session->uniforms;
+      shaderUniformsInitLocations(&session->frozenUniforms, session->frozenProgram);
+      for (int i = 0; i < session->frozenUniforms.hintUniformsCount; i++)
+        session->frozenUniforms.hintUniforms[i] = glGetUniformLocation(session->frozenProgram, session->frozenUniforms.hintUniformsName[i]);
+      session->dirty = 1;
+      fprintf(stderr, "[FREEZE] Using program with %d constant uniforms\n", session->frozenCount);
+    } else if (build->state == PROGRAM_BUILD_DONE) {
+      glDeleteProgram(build->program); // Values changed while it was building
+    } else {
+      fprintf(stderr, "[ERR] Building the frozen program failed:\n%s\n", infolog);
+    }
+    build->state = PROGRAM_BUILD_IDLE;
+  }
+
+  if (session->config.freeze && !session->frozenProgram && !glProgramBuildPending(build) &&
+      session->freezeAttempt != hash && now - session->lastEdit > FREEZE_IDLE_TIME) {
+    session->freezeAttempt = hash;
+    shaderSessionFreeze(session);
+  }
+}
+
+//Queues the quality tier variants on the compile worker, or builds them here when the worker is not running
+void shaderSessionBuildTiers(struct ShaderSession* session) {
+  for (int i = 0; i < session->config.tierCount; i++) {
+    if (session->reloader.running) shaderReloaderRequest(&session->reloader, i, &session->config, session->config.tierDefines[i]);
+    else shaderSessionSetProgram(session, i, glProgramCompile(session->config.fragmentShader, session->config.vertexShader, session->config.tierDefines[i]));
+  }
+}
+
+//Polls the program build started by shaderSessionLoadProgram, the previous program keeps being drawn meanwhile
+int shaderSessionPollProgram(struct ShaderSession* session) {
+  if (!glProgramBuildPending(&session->build) || !glProgramBuildPoll(&session->build)) return 0;
+
+  if (session->build.state == PROGRAM_BUILD_FAILED) {
     fprintf(stderr, "Error compiling shaders %s %s\n", session->config.vertexShader, session->config.fragmentShader);
     gltSetText(session->errorText, infolog);
+    session->dirty = 1;
     return 1;
-  } else {
-    fprintf(stderr, "[OK] Shader compilation.\n");
   }
-  session->shaderProgram = program;
-  glUseProgram(session->shaderProgram);
 
-  shaderUniformsInitLocations(&session->uniforms, session->shaderProgram);
-  shaderUniformsFindUserDefined(&session->uniforms, session->shaderProgram);
-  shaderUniformsUpload(&session->uniforms);
-  shaderUserUniformsUpload(&session->uniforms);
+  fprintf(stderr, "[OK] Shader compilation.\n");
+  shaderSessionSetProgram(session, session->config.tierCount, session->build.program);
+  session->build.state = PROGRAM_BUILD_IDLE;
   return 0;
 }
 
+int shaderSessionLoadProgram(struct ShaderSession* session) {
+  char* fsource = glslPreprocess(session->config.fragmentShader, session->config.defines);
+  char* vsource = glslPreprocess(session->config.vertexShader, session->config.defines);
+  if (!fsource || !vsource) {
+    fprintf(stderr, "Error reading shaders %s %s\n", session->config.vertexShader, session->config.fragmentShader);
+    gltSetText(session->errorText, infolog);
+    free(fsource);
+    free(vsource);
+    return 1;
+  }
+
+  glProgramBuildStart(&session->build, fsource, vsource, session->config.fragmentShader);
+  free(fsource);
+  free(vsource);
+
+  if (session->build.state == PROGRAM_BUILD_DONE) {
+    shaderSessionSetProgram(session, session->config.tierCount, session->build.program);
+    session->build.state = PROGRAM_BUILD_IDLE;
+    return 0;
+  }
+  return shaderSessionPollProgram(session);
+}
+
 int shaderSessionLoadUserTextures(struct ShaderSession* session) {
   char* texturesPaths[MAX_TEXTURE_SLOTS];
 
   for (int i = 0; i < session->config.textureCount; i++)
     texturesPaths[i] = session->config.texturePath[i];
 
-  session->usertextures = glTexturePackLoad(session->config.textureCount, texturesPaths);
+  if (session->config.textureArray && session->config.textureCount) {
+    session->usertextureArray = glTextureArrayLoad(session->config.textureCount, texturesPaths, session->displayWidth, session->displayHeight,
+                                                   session->config.textureFilter);
+    return session->usertextureArray == 0;
+  }
+
+  session->usertextures = glTexturePackLoad(session->config.textureCount, texturesPaths, session->displayWidth, session->displayHeight,
+                                            session->config.textureFilter);
   return 0;
 }
 
@@ -954,51 +4972,85 @@ int shaderSessionCreate(struct ShaderSession* session, const char* configfile) {
     return 1;
   }
 
-  session->errorText = gltCreateText();
+  session->configPath         = configfile;
+  session->errorText          = gltCreateText();
+  renderTargetPool.budget     = (long long)session->config.poolBudget * 1000000LL;
+  textureCacheLimit           = (long long)session->config.textureCacheSize * 1000000LL;
+  session->reloader.inotifyfd = -1;
+  session->reloader.eventfd   = -1;
   shaderSessionLoadUserTextures(session);
   shaderSessionLoadMesh(session);
 
   for (int i = 0; i < session->usertextures.textureCount; i++)
     session->uniforms.userTexturesId[i] = session->usertextures.textures[i].id;
 
-  session->uniforms.userTexturesCount = session->usertextures.textureCount;
+  session->uniforms.userTexturesCount  = session->usertextures.textureCount;
+  session->uniforms.userTextureArrayId = session->usertextureArray;
 
+  session->tier = session->config.tierCount;
+  renderGraphCreate(&session->graph, &session->config);
   shaderSessionLoadProgram(session);
-  glFrameBufferCreate(&session->fbo, 720, 640);
+  upscalerCreate(&session->upscaler);
+  interleaveCreate(&session->interleave, session->config.interleave);
+  tiledRendererCreate(&session->tiled, session->config.tiles, session->config.sliceBudget);
+  loopCacheCreate(&session->loop, session->config.loopPeriod, session->config.loopFps, session->config.loopBudget, session->config.loopCacheSize);
+  framePacerInit(&session->pacer, session->config.targetFps);
+  resolutionGovernorInit(&session->governor, session->config.frameBudget, session->config.minScale, session->config.maxScale, session->config.tierCount);
 
   return 0;
 }
 
-void shaderSessionBeginFBO(struct ShaderSession* session) {
+int shaderSessionTiled(struct ShaderSession* session) {
+  return session->tiled.grid > 1 && !session->graph.passCount;
+}
+
+//Static programs are drawn once, interleaving them would leave the frame incomplete
+int shaderSessionInterleaved(struct ShaderSession* session) {
+  return session->interleave.factor > 1 && !session->onDemand && !shaderSessionTiled(session);
+}
 
+void shaderSessionUpdateSize(struct ShaderSession* session) {
   session->screenWidth  = session->uniforms.width;
   session->screenHeight = session->uniforms.height;
 
-  session->fboWidth  = session->screenWidth / session->config.upscalingFactor;
-  session->fboHeight = session->screenHeight / session->config.upscalingFactor;
+  session->fboWidth  = (int)(session->screenWidth * session->config.renderScale + 0.5f);
+  session->fboHeight = (int)(session->screenHeight * session->config.renderScale + 0.5f);
+  if (session->fboWidth < 1) session->fboWidth = 1;
+  if (session->fboHeight < 1) session->fboHeight = 1;
+}
+
+void shaderSessionBeginFBO(struct ShaderSession* session) {
+  shaderSessionUpdateSize(session);
+
+  gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_BEGIN_FBO);
 
-  glFrameBufferResize(&session->fbo, session->fboWidth, session->fboHeight);
+  // Only the interleave mask uses a depth buffer, full screen quads are drawn without depth test
+  struct glFrameBufferDesc desc = glFrameBufferColor(session->fboWidth, session->fboHeight, GL_RGBA8);
+  desc.depth                    = shaderSessionInterleaved(session);
+  session->fbo                  = renderTargetAcquire(&renderTargetPool, desc);
 
-  glBindFramebuffer(GL_FRAMEBUFFER, session->fbo.fbo);
+  glBindFramebuffer(GL_FRAMEBUFFER, session->fbo ? session->fbo->fbo : 0);
 
   glViewport(0, 0, session->fboWidth, session->fboHeight);
 
   glClearColor(0.0, 0.0, 0.0, 1.0);
-  glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+  glClear(desc.depth ? GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT : GL_COLOR_BUFFER_BIT);
+
+  if (desc.depth)
+    interleaveBeginMask(&session->interleave, session->fboWidth, session->fboHeight, session->quad.vao);
+  gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_BEGIN_FBO);
 }
 
 void shaderSessionEndFBO(struct ShaderSession* session) {
-  glBindFramebuffer(GL_READ_FRAMEBUFFER, session->fbo.fbo);
-  glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-
-  glBlitFramebuffer(
-    0, 0, session->fboWidth, session->fboHeight,
-    0, 0, session->screenWidth, session->screenHeight,
-    GL_COLOR_BUFFER_BIT,
-    GL_LINEAR);
-
-  glBindFramebuffer(GL_FRAMEBUFFER, 0);
-  glViewport(0, 0, session->screenWidth, session->screenHeight);
+  gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_END_FBO);
+  struct glFrameBuffer* source = session->fbo;
+  if (source && shaderSessionInterleaved(session))
+    source = interleaveResolve(&session->interleave, session->fbo, session->quad.vao);
+  if (source)
+    upscalerApply(&session->upscaler, session->config.upscaler, source, session->screenWidth, session->screenHeight, session->config.sharpness, session->quad.vao);
+  renderTargetRelease(&renderTargetPool, session->fbo);
+  session->fbo = NULL;
+  gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_END_FBO);
 }
 
 int shaderSessionDrawErrored(struct ShaderSession* session) {
@@ -1017,13 +5069,55 @@ int shaderSessionConfigMenu(struct ShaderSession* session) {
                  NK_WINDOW_CLOSABLE | NK_WINDOW_MINIMIZABLE | NK_WINDOW_TITLE)) {
 
     nk_layout_row_dynamic(ctx, 25, 1);
-    nk_property_int(ctx, "upscalingFactor:", 1, &session->config.upscalingFactor, 12, 1, 1);
+    nk_property_float(ctx, "renderScale:", 0.1f, &session->config.renderScale, 1.0f, 0.05f, 0.01f);
+    nk_layout_row_dynamic(ctx, 25, 1);
+    session->config.upscaler = nk_combo(ctx, upscalerNames, UPSCALER_COUNT, session->config.upscaler, 25, nk_vec2(200, 120));
+    if (session->config.upscaler == UPSCALER_SHARPEN) {
+      nk_layout_row_dynamic(ctx, 25, 1);
+      nk_property_float(ctx, "sharpness:", 0.0f, &session->config.sharpness, 1.0f, 0.05f, 0.01f);
+    }
+    nk_layout_row_dynamic(ctx, 15, 1);
+    char statusText[MAX_LINE_LENGTH];
+    if (session->governor.budget > 0.0f) {
+      snprintf(statusText, sizeof(statusText), "governor scale: %.2f tier: %d/%d", session->governor.scale, session->tier, session->config.tierCount);
+      nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
+      nk_layout_row_dynamic(ctx, 15, 1);
+    }
+    snprintf(statusText, sizeof(statusText), "late: %ld missed: %ld", session->pacer.late, session->pacer.missed);
+    nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
+    nk_layout_row_dynamic(ctx, 15, 1);
+    snprintf(statusText, sizeof(statusText), "suspended: %.1fs", session->occlusion.suspendedTotal / 1e9);
+    nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
+
+    if (shaderSessionTiled(session)) {
+      nk_layout_row_dynamic(ctx, 15, 1);
+      snprintf(statusText, sizeof(statusText), "tiles/slice: %d (%.2fms/tile)", session->tiled.lastSliceTiles, session->tiled.tileMs);
+      nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
+    }
+    if (shaderSessionInterleaved(session)) {
+      nk_layout_row_dynamic(ctx, 15, 1);
+      snprintf(statusText, sizeof(statusText), "skipped: %lld px/frame", session->interleave.skippedPixels);
+      nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
+    }
+
+    struct GpuProfilerStats frameStats;
+    gpuProfilerFrameStats(&gpuProfiler, &frameStats);
+    nk_layout_row_dynamic(ctx, 15, 1);
+    snprintf(statusText, sizeof(statusText), "gpu: %.2fms p95: %.2fms", frameStats.avg, frameStats.p95);
+    nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
     nk_layout_row_dynamic(ctx, 15, 1);
     nk_label(ctx, "", NK_TEXT_ALIGN_LEFT);
 
     nk_layout_row_dynamic(ctx, 25, 1);
     nk_label(ctx, "User Uniforms:", NK_TEXT_ALIGN_LEFT);
 
+    nk_layout_row_dynamic(ctx, 25, 2);
+    if (nk_button_label(ctx, "freeze")) shaderSessionFreeze(session);
+    if (session->frozenProgram) snprintf(statusText, sizeof(statusText), "frozen: %d", session->frozenCount);
+    else
+      snprintf(statusText, sizeof(statusText), glProgramBuildPending(&session->freezeBuild) ? "freezing..." : "generic");
+    nk_label(ctx, statusText, NK_TEXT_ALIGN_LEFT);
+
     for (int i = 0; i < session->uniforms.hintUniformsCount; ++i) {
       nk_layout_row_dynamic(ctx, 25, 1);
 
@@ -1089,34 +5183,233 @@ int shaderSessionConfigMenu(struct ShaderSession* session) {
   return 0;
 }
 
+//Static programs only redraw after a resize, an expose or a GUI edit
+//Rereads the configuration after it changed on disk, only keys that can be applied at runtime are taken
+void shaderSessionReloadConfig(struct ShaderSession* session) {
+  struct SessionConfiguration config;
+  if (sessionConfigurationParse(&config, session->configPath)) return;
+
+  memcpy(session->config.vertexShader, config.vertexShader, MAX_LINE_LENGTH);
+  memcpy(session->config.fragmentShader, config.fragmentShader, MAX_LINE_LENGTH);
+  memcpy(session->config.defines, config.defines, MAX_DEFINES_LENGTH);
+  if (config.tierCount == session->config.tierCount)
+    memcpy(session->config.tierDefines, config.tierDefines, sizeof(config.tierDefines));
+  else fprintf(stderr, "[WARN] Number of quality tiers changed, restart to apply it\n");
+  session->config.renderScale = config.renderScale;
+  session->config.upscaler    = config.upscaler;
+  session->config.sharpness   = config.sharpness;
+  shaderReloaderWatchAll(&session->reloader, session->configPath, &session->config);
+}
+
+//Starts compiles for changed files and swaps in finished programs, called between frames
+void shaderSessionHotReload(struct ShaderSession* session) {
+  int changes = shaderReloaderChanges(&session->reloader);
+  if (changes & 2) {
+    fprintf(stderr, "[RELOAD] Configuration changed\n");
+    shaderSessionReloadConfig(session);
+    session->dirty = 1;
+  }
+  if (changes) {
+    fprintf(stderr, "[RELOAD] Compiling %s %s\n", session->config.vertexShader, session->config.fragmentShader);
+    shaderReloaderRequest(&session->reloader, session->config.tierCount, &session->config, session->config.defines);
+    shaderSessionBuildTiers(session);
+  }
+
+  char   log[MAX_LOG_SIZE];
+  int    failed, tier;
+  GLuint program = shaderReloaderPoll(&session->reloader, &tier, log, &failed);
+  if (failed && tier < session->config.tierCount) {
+    fprintf(stderr, "[ERR] Building quality tier %d failed:\n%s\n", tier, log);
+  } else if (failed) {
+    fprintf(stderr, "[ERR] Hot reload failed, keeping the previous program\n");
+    gltSetText(session->errorText, log);
+    session->reloadFailed = 1;
+    session->dirty        = 1;
+  }
+  if (program && tier < session->config.tierCount) {
+    fprintf(stderr, "[OK] Built quality tier %d\n", tier);
+    shaderSessionSetProgram(session, tier, program);
+  } else if (program) {
+    fprintf(stderr, "[OK] Hot reloaded program\n");
+    shaderSessionSetProgram(session, tier, program);
+    shaderReloaderWatchAll(&session->reloader, session->configPath, &session->config);
+    loopCacheRelease(&session->loop);
+    session->loop.failed  = 0;
+    session->reloadFailed = 0;
+  }
+}
+
+int shaderSessionNeedsRedraw(struct ShaderSession* session) {
+  return !session->onDemand || session->dirty;
+}
+
+//Prepares the baked loop for the current output size, baking it in the background first if it is not cached yet.
+//Returns whether the current frame can be presented from the loop cache, frames are rendered live until then.
+int shaderSessionLooped(struct ShaderSession* session) {
+  struct LoopCache* loop = &session->loop;
+  if (loop->period <= 0.0f || loop->failed || session->onDemand || session->graph.passCount || !session->shaderProgram) return 0;
+
+  shaderSessionUpdateSize(session);
+  if (loop->path[0] && loop->screenWidth == session->screenWidth && loop->screenHeight == session->screenHeight) {
+    if (loop->uniformHash == shaderUniformsHashUser(&session->uniforms))
+      return loopCacheUpdate(loop, session->uniforms.time, session->shaderProgram, &session->uniforms, session->quad.vao,
+                             session->screenWidth, session->screenHeight);
+    if (monotonicNow() - session->lastEdit < FREEZE_IDLE_TIME) return 0; // Live while the values are being edited, then baked again
+  }
+
+  if (shaderUniformsUsesInput(&session->uniforms)) {
+    fprintf(stderr, "[LOOP] Program reads input uniforms, loop cache disabled\n");
+    loop->failed = 1;
+    return 0;
+  }
+
+  if (!loop->program) loop->program = glProgramCompileSource(loopPresentSource, upscaleVertexSource, "loop present");
+  char* vsource    = glslPreprocess(session->config.vertexShader, session->config.defines);
+  char* fsource    = glslPreprocess(session->config.fragmentShader, session->config.defines);
+  loop->sourceHash = hashString(hashString(HASH_SEED, vsource), fsource);
+  free(vsource);
+  free(fsource);
+  for (int i = 0; i < session->config.textureCount; i++) {
+    char*       file = findfile(session->config.texturePath[i]);
+    struct stat info;
+    loop->sourceHash = hashString(loop->sourceHash, session->config.texturePath[i]);
+    if (file && stat(file, &info) == 0) { // Edited textures give a new loop, as in textureCachePath
+      loop->sourceHash = hashBytes(loop->sourceHash, &info.st_mtim, sizeof(info.st_mtim));
+      loop->sourceHash = hashBytes(loop->sourceHash, &info.st_size, sizeof(info.st_size));
+    }
+    free(file);
+  }
+
+  loopCacheRelease(loop);
+  loop->screenWidth  = session->screenWidth;
+  loop->screenHeight = session->screenHeight;
+  loop->uniformHash  = shaderUniformsHashUser(&session->uniforms);
+
+  int      params[] = {session->fboWidth, session->fboHeight, loop->fps};
+  uint64_t key      = hashBytes(loop->sourceHash, params, sizeof(params));
+  key               = hashBytes(key, &loop->period, sizeof(loop->period));
+  key               = hashBytes(key, &loop->uniformHash, sizeof(loop->uniformHash));
+
+  if (!loop->program || cacheDirectory(loop->path, sizeof(loop->path), "loops")) {
+    loop->failed = 1;
+    return 0;
+  }
+  size_t len = strlen(loop->path);
+  snprintf(loop->path + len, sizeof(loop->path) - len, "/%016llx.loop", (unsigned long long)key);
+
+  int baking = !exists(loop->path);
+  if (baking ? loopCacheBakeBegin(loop, session->fboWidth, session->fboHeight) : loopCacheLoad(loop, session->fboWidth, session->fboHeight)) {
+    if (!baking) unlink(loop->path);
+    loopCacheRelease(loop);
+    loop->failed = 1;
+  }
+  return 0;
+}
+
+//Renders one slice of the frame in progress and presents the last completed frame
+void shaderSessionDrawTiled(struct ShaderSession* session) {
+  shaderSessionUpdateSize(session);
+
+  gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_DRAW);
+  tiledRendererSlice(&session->tiled, session->shaderProgram, &session->uniforms, session->fboWidth, session->fboHeight, session->quad.vao);
+  gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_DRAW);
+
+  glBindFramebuffer(GL_FRAMEBUFFER, 0);
+  glViewport(0, 0, session->screenWidth, session->screenHeight);
+
+  struct glFrameBuffer* completed = tiledRendererCompleted(&session->tiled);
+  if (completed) {
+    gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_END_FBO);
+    upscalerApply(&session->upscaler, session->config.upscaler, completed, session->screenWidth, session->screenHeight, session->config.sharpness, session->quad.vao);
+    gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_END_FBO);
+  }
+
+  // Static programs keep iterating until their frame is complete
+  session->dirty = session->tiled.inProgress;
+}
+
 int shaderSessionDraw(struct ShaderSession* session) {
+  if (session->shaderProgram == 0 && glProgramBuildPending(&session->build)) { // First build still running
+    glBindFramebuffer(GL_FRAMEBUFFER, 0);
+    glClearColor(0.0f, 0.0f, 0.0f, 1.0f);
+    glClear(GL_COLOR_BUFFER_BIT);
+    return 0;
+  }
   if (session->shaderProgram == 0) {
     shaderSessionDrawErrored(session);
     return 0;
   }
+  renderTargetPoolFrame(&renderTargetPool);
+
+  if (shaderSessionLooped(session)) {
+    gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_DRAW);
+    loopCachePresent(&session->loop, session->uniforms.time, session->screenWidth, session->screenHeight, session->quad.vao);
+    gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_DRAW);
+    session->dirty = 0;
+    return 0;
+  }
+
+  if (shaderSessionTiled(session)) {
+    shaderSessionDrawTiled(session);
+    return 0;
+  }
+
+  shaderUniformsBeginFrame(&session->uniforms);
+  if (session->graph.passCount) {
+    shaderSessionUpdateSize(session);
+    gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_BUFFERS);
+    renderGraphExecute(&session->graph, &session->config, &session->uniforms, session->screenWidth, session->screenHeight, session->quad.vao);
+    gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_BUFFERS);
+  }
 
-  if (session->config.upscalingFactor > 1)
+  int useFBO = session->config.renderScale < 1.0f || session->offscreen || shaderSessionInterleaved(session);
+  if (useFBO)
     shaderSessionBeginFBO(session);
 
-  glUseProgram(session->shaderProgram);
-  shaderUniformsUpload(&session->uniforms);
-  shaderUserUniformsUpload(&session->uniforms);
+  GLuint                 program  = session->shaderProgram;
+  struct ShaderUniforms* uniforms = &session->uniforms;
+  if (session->frozenProgram) {
+    memcpy(&session->frozenUniforms, &session->uniforms, offsetof(struct ShaderUniforms, iQuality));
+    program  = session->frozenProgram;
+    uniforms = &session->frozenUniforms;
+  }
+  renderGraphBindChannels(&session->graph, &session->config, RENDER_PASS_IMAGE, uniforms);
+
+  glUseProgram(program);
+  shaderUniformsUpload(uniforms);
+  shaderUserUniformsUpload(uniforms);
   glBindVertexArray(session->quad.vao);
+  gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_DRAW);
   glDrawArrays(GL_TRIANGLES, 0, 6);
+  gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_DRAW);
+  renderGraphRelease(&session->graph);
 
-  if (session->config.upscalingFactor > 1)
+  if (useFBO)
     shaderSessionEndFBO(session);
 
+  if (session->reloadFailed) shaderSessionDrawErrored(session);
+  session->uniforms.frame++;
+  session->dirty = 0;
   return 0;
 }
 
 int shaderSessionDispose(struct ShaderSession* session) {
   gltDeleteText(session->errorText);
-  glDeleteProgram(session->shaderProgram);
+  for (int i = 0; i <= MAX_QUALITY_TIERS; i++) glDeleteProgram(session->programs[i]);
+  glDeleteProgram(session->frozenProgram);
   glMeshDispose(&session->quad);
   glMeshDispose(&session->cube);
   glTexturePackDispose(&session->usertextures);
-  glFrameBufferDispose(&session->fbo);
+  glTextureArrayDispose(session->usertextureArray);
+  renderTargetPoolDispose(&renderTargetPool);
+  upscalerDispose(&session->upscaler);
+  interleaveDispose(&session->interleave);
+  tiledRendererDispose(&session->tiled);
+  loopCacheDispose(&session->loop);
+  renderGraphDispose(&session->graph);
+  shaderReloaderDispose(&session->reloader);
+  framePacerDispose(&session->pacer);
+  gpuProfilerDispose(&gpuProfiler);
   return 0;
 }
 
@@ -1124,6 +5417,7 @@ int shaderSessionDispose(struct ShaderSession* session) {
 
 void printUsage() {
   fprintf(stderr, "Usage: <executable> <config_file_path>\n");
+  fprintf(stderr, "       <executable> --bench <config_file_path> [--frames N] [--size WxH]\n");
 }
 
 struct nk_colorf bg;
@@ -1160,27 +5454,60 @@ int application(int argc, char** argv, Display* dpy, Window win) {
   glViewport(0, 0, inputState.windowWidth, inputState.windowHeight); // Set initial viewport
 
   // Select input events to listen for
-  XSelectInput(dpy, win, ExposureMask | KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | StructureNotifyMask); // For ConfigureNotify (resize)
+  XSelectInput(dpy, win, ExposureMask | KeyPressMask | KeyReleaseMask | ButtonPressMask | ButtonReleaseMask | PointerMotionMask | StructureNotifyMask | VisibilityChangeMask); // For ConfigureNotify (resize)
 
   const char* configfile = argv[1];
+  session.displayWidth   = DisplayWidth(dpy, DefaultScreen(dpy));
+  session.displayHeight  = DisplayHeight(dpy, DefaultScreen(dpy));
 
   if (shaderSessionCreate(&session, configfile)) {
     fprintf(stderr, "Error initializing session\n");
     return 1;
   }
+  glProgramCacheDump(stderr);
+  shaderReloaderCreate(&session.reloader, dpy, configfile, &session.config);
+  shaderSessionBuildTiers(&session);
+  session.pacer.wakefds[0] = session.reloader.inotifyfd;
+  session.pacer.wakefds[1] = session.reloader.eventfd;
+
+  glxSwapIntervalSet(dpy, win, session.config.vsync ? 1 : 0);
+  gpuProfilerInit(&gpuProfiler);
+  occlusionTrackerInit(&session.occlusion, dpy, win);
 
   struct timeval start_time, current_time;
   gettimeofday(&start_time, NULL);
 
   while (1) {
     XEvent ev;
+    int suspended = occlusionTrackerSuspended(&session.occlusion);
+    framePacerWait(&session.pacer, dpy, !suspended && (shaderSessionNeedsRedraw(&session) || shaderReloaderPending(&session.reloader) ||
+                                                         glProgramBuildPending(&session.build) || glProgramBuildPending(&session.freezeBuild)));
+    shaderSessionPollProgram(&session);
+    shaderSessionHotReload(&session);
+
+    if (profilerDumpRequested) {
+      profilerDumpRequested = 0;
+      gpuProfilerCollect(&gpuProfiler);
+      gpuProfilerDump(&gpuProfiler, stderr);
+      resolutionGovernorDump(&session.governor, stderr);
+      glProgramCacheDump(stderr);
+      glFrameBufferDump(stderr);
+      renderTargetPoolDump(&renderTargetPool, stderr);
+      if (shaderSessionInterleaved(&session))
+        fprintf(stderr, "[INTERLEAVE] skipped %lld px/frame, %lld px total\n", session.interleave.skippedPixels, session.interleave.skippedTotal);
+    }
+
     nk_input_begin(ctx);
     // Process all pending events
     while (XPending(dpy)) {
       XNextEvent(dpy, &ev);
       nk_x11_handle_event(&ev);
+      occlusionTrackerHandleEvent(&session.occlusion, dpy, &ev);
 
       switch (ev.type) {
+        case Expose:
+          session.dirty = 1;
+          break;
         case ConfigureNotify:
           // Window was resized
           if (ev.xconfigure.width != inputState.windowWidth ||
@@ -1188,6 +5515,7 @@ int application(int argc, char** argv, Display* dpy, Window win) {
             inputState.windowWidth  = ev.xconfigure.width;
             inputState.windowHeight = ev.xconfigure.height;
             glViewport(0, 0, inputState.windowWidth, inputState.windowHeight);
+            session.dirty = 1;
           }
           break;
         case MotionNotify:
@@ -1244,9 +5572,32 @@ int application(int argc, char** argv, Display* dpy, Window win) {
 
     nk_input_end(ctx);
 
+    union UniformValue previousValues[MAX_HINT_UNIFORMS];
+    struct SessionConfiguration previousConfig = session.config;
+    memcpy(previousValues, session.uniforms.hintUniformsValue, sizeof(previousValues));
+
     shaderSessionConfigMenu(&session);
     //applicationGuiTest();
 
+    // GUI edits and interaction with the menu itself need a new frame
+    if (memcmp(previousValues, session.uniforms.hintUniformsValue, sizeof(previousValues)) ||
+        previousConfig.renderScale != session.config.renderScale ||
+        previousConfig.upscaler != session.config.upscaler ||
+        previousConfig.sharpness != session.config.sharpness ||
+        nk_window_is_any_hovered(ctx) || nk_item_is_any_active(ctx))
+      session.dirty = 1;
+
+    shaderSessionUpdateFreeze(&session);
+
+    // The desktop was uncovered, whatever was last presented may be stale
+    if (suspended && !occlusionTrackerSuspended(&session.occlusion)) session.dirty = 1;
+
+    // Woken up by events before the frame is due, hidden, or nothing to redraw
+    if (session.occlusion.suspendedSince || !shaderSessionNeedsRedraw(&session) || !framePacerDue(&session.pacer)) {
+      nk_clear(ctx);
+      continue;
+    }
+
     // Calculate elapsed time
     gettimeofday(&current_time, NULL);
     float elapsed_time = (current_time.tv_sec - start_time.tv_sec) +
@@ -1255,14 +5606,28 @@ int application(int argc, char** argv, Display* dpy, Window win) {
     // Update uniforms with current input state and time
     shaderUniformsUpdate(&session.uniforms, &inputState, elapsed_time);
 
+    gpuProfilerBeginFrame(&gpuProfiler);
+    if (session.governor.budget > 0.0f && !shaderSessionTiled(&session) && !session.loop.path[0]) {
+      session.config.renderScale = resolutionGovernorUpdate(&session.governor, &gpuProfiler);
+      shaderSessionSelectTier(&session, session.governor.tier);
+      session.governor.tier = session.tier; // The tier only changes once its variant is built
+    }
+
     glClearColor(0.0f, 0.0f, 0.7f, 1.0f);
     glClear(GL_COLOR_BUFFER_BIT);
 
     shaderSessionDraw(&session);
+
+    gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_GUI);
     nk_x11_render(NK_ANTI_ALIASING_ON, MAX_VERTEX_BUFFER, MAX_ELEMENT_BUFFER);
+    gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_GUI);
 
+    gpuProfilerBegin(&gpuProfiler, PROFILER_STAGE_SWAP);
     glXSwapBuffers(dpy, win);
-    usleep(6000); // Approximately 60 FPS
+    gpuProfilerEnd(&gpuProfiler, PROFILER_STAGE_SWAP);
+
+    gpuProfilerEndFrame(&gpuProfiler);
+    framePacerPresent(&session.pacer);
   }
 }
 
@@ -1298,19 +5663,10 @@ void nuklearInit(Window win, Display* dpy) {
 void nuklearDispose() {
   nk_x11_shutdown();
 }
-int main(int argc, char** argv) {
-  Display* dpy = XOpenDisplay(NULL);
-  if (!dpy) {
-    fprintf(stderr, "Cannot open display\n");
-    return 1;
-  }
-
-  int    screen = DefaultScreen(dpy);
-  Window root   = RootWindow(dpy, screen);
-
-  static int visualAttribs[] = {
+GLXFBConfig glxChooseConfig(Display* dpy, int screen, int drawableBit) {
+  int visualAttribs[] = {
     GLX_X_RENDERABLE, True,
-    GLX_DRAWABLE_TYPE, GLX_WINDOW_BIT,
+    GLX_DRAWABLE_TYPE, drawableBit,
     GLX_RENDER_TYPE, GLX_RGBA_BIT,
     GLX_X_VISUAL_TYPE, GLX_TRUE_COLOR,
     GLX_RED_SIZE, 8,
@@ -1319,7 +5675,7 @@ int main(int argc, char** argv) {
     GLX_ALPHA_SIZE, 8,
     GLX_DEPTH_SIZE, 24,
     GLX_STENCIL_SIZE, 8,
-    GLX_DOUBLEBUFFER, True,
+    GLX_DOUBLEBUFFER, drawableBit == GLX_WINDOW_BIT,
     None};
 
   int fbCount = 0;
@@ -1327,11 +5683,211 @@ int main(int argc, char** argv) {
   GLXFBConfig* fbConfigs = glXChooseFBConfig(dpy, screen, visualAttribs, &fbCount);
   if (!fbConfigs || fbCount == 0) {
     fprintf(stderr, "No suitable framebuffer configs found\n");
-    return 1;
+    return 0;
   }
 
   GLXFBConfig fbConfig = fbConfigs[0];
   XFree(fbConfigs); // Clean up
+  return fbConfig;
+}
+
+GLXContext glxCreateContext(Display* dpy, GLXFBConfig fbConfig, GLXContext share) {
+  int majorVersion = 3;
+  int minorVersion = 3;
+
+  int context_attribs[] = {
+    GLX_CONTEXT_MAJOR_VERSION_ARB, majorVersion,
+    GLX_CONTEXT_MINOR_VERSION_ARB, minorVersion,
+    GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
+    None};
+
+  glXCreateContextAttribsARBProc glXCreateContextAttribsARB = (glXCreateContextAttribsARBProc)glXGetProcAddressARB((const GLubyte*)"glXCreateContextAttribsARB");
+
+  return glXCreateContextAttribsARB(dpy, fbConfig, share, True, context_attribs);
+}
+
+int benchmarkCompare(const void* a, const void* b) {
+  double x = *(const double*)a, y = *(const double*)b;
+  return (x > y) - (x < y);
+}
+
+//Copies src as the contents of a JSON string, escaping quotes, backslashes and control characters
+void benchmarkJsonEscape(char* dst, size_t size, const char* src) {
+  size_t length = 0;
+  for (; src && *src && length + 7 < size; src++) {
+    unsigned char c = *src;
+    if (c == '"' || c == '\\') length += snprintf(dst + length, size - length, "\\%c", c);
+    else if (c < 0x20) length += snprintf(dst + length, size - length, "\\u%04x", c);
+    else dst[length++] = c;
+  }
+  dst[length] = 0;
+}
+
+//Renders a fixed number of frames into the session FBO of an offscreen pbuffer and prints
+//frame time percentiles as a single JSON object on stdout. Diagnostics go to stderr.
+int benchmark(int argc, char** argv) {
+  const char* configfile = NULL;
+  int         frames     = BENCH_DEFAULT_FRAMES;
+  int         width      = BENCH_DEFAULT_WIDTH;
+  int         height     = BENCH_DEFAULT_HEIGHT;
+
+  for (int i = 2; i < argc; i++) {
+    if ((strcmp(argv[i], "--frames") == 0 || strcmp(argv[i], "--size") == 0) && i + 1 == argc) {
+      fprintf(stderr, "Missing value for %s\n", argv[i]);
+      return 1;
+    }
+    if (strcmp(argv[i], "--frames") == 0) frames = atoi(argv[++i]);
+    else if (strcmp(argv[i], "--size") == 0) {
+      if (sscanf(argv[++i], "%dx%d", &width, &height) != 2) {
+        fprintf(stderr, "Invalid size %s, expected WxH\n", argv[i]);
+        return 1;
+      }
+    } else
+      configfile = argv[i];
+  }
+
+  if (!configfile || frames <= 0 || width <= 0 || height <= 0) {
+    printUsage();
+    return 1;
+  }
+
+  // Keep stdout for the results only
+  int out = dup(STDOUT_FILENO);
+  fflush(stdout);
+  dup2(STDERR_FILENO, STDOUT_FILENO);
+
+  Display* dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    fprintf(stderr, "Cannot open display\n");
+    return 1;
+  }
+
+  GLXFBConfig fbConfig = glxChooseConfig(dpy, DefaultScreen(dpy), GLX_PBUFFER_BIT);
+  if (!fbConfig) return 1;
+
+  int pbufferAttribs[] = {
+    GLX_PBUFFER_WIDTH, width,
+    GLX_PBUFFER_HEIGHT, height,
+    None};
+
+  GLXPbuffer pbuffer = glXCreatePbuffer(dpy, fbConfig, pbufferAttribs);
+  GLXContext glc     = glxCreateContext(dpy, fbConfig, 0);
+  if (!glc || !glXMakeContextCurrent(dpy, pbuffer, pbuffer, glc)) {
+    fprintf(stderr, "Failed to create offscreen context\n");
+    return 1;
+  }
+
+  if (!gladLoadGL()) {
+    fprintf(stderr, "Failed to load glad.\n");
+    return 1;
+  }
+
+  gltInit();
+
+  struct ShaderSession session    = {0};
+  struct InputState    inputState = {0};
+  inputState.windowWidth          = width;
+  inputState.windowHeight         = height;
+  session.displayWidth            = width;
+  session.displayHeight           = height;
+
+  if (shaderSessionCreate(&session, configfile)) {
+    fprintf(stderr, "Error initializing session\n");
+    return 1;
+  }
+  while (glProgramBuildPending(&session.build)) {
+    usleep(1000);
+    shaderSessionPollProgram(&session);
+  }
+  if (!session.shaderProgram) {
+    fprintf(stderr, "Error initializing session\n");
+    return 1;
+  }
+  session.offscreen = 1;
+  if (session.tiled.grid > 1) { // A draw would only render one slice, timing slices instead of frames
+    fprintf(stderr, "[WARN] tiles=%d ignored in benchmark mode, every frame is rendered whole\n", session.tiled.grid);
+    tiledRendererDispose(&session.tiled);
+    tiledRendererCreate(&session.tiled, 1, session.config.sliceBudget);
+    session.config.tiles = 1;
+  }
+  glProgramCacheDump(stderr);
+  gpuProfilerInit(&gpuProfiler);
+
+  double* frameTimes = malloc(frames * sizeof(double));
+  double  total      = 0.0;
+  if (!frameTimes) {
+    fprintf(stderr, "Cannot allocate %d frame times\n", frames);
+    return 1;
+  }
+
+  for (int i = -BENCH_WARMUP_FRAMES; i < frames; i++) {
+    long long begin = monotonicNow();
+
+    shaderUniformsUpdate(&session.uniforms, &inputState, (i + BENCH_WARMUP_FRAMES) * BENCH_TIMESTEP);
+    gpuProfilerBeginFrame(&gpuProfiler);
+    shaderSessionDraw(&session);
+    gpuProfilerEndFrame(&gpuProfiler);
+    glFinish();
+
+    if (i >= 0) {
+      frameTimes[i] = (monotonicNow() - begin) / 1e6;
+      total += frameTimes[i];
+    }
+  }
+  gpuProfilerCollect(&gpuProfiler);
+
+  qsort(frameTimes, frames, sizeof(double), benchmarkCompare);
+
+  struct GpuProfilerStats drawStats, bufferStats;
+  gpuProfilerStats(&gpuProfiler, PROFILER_STAGE_DRAW, &drawStats);
+  gpuProfilerStats(&gpuProfiler, PROFILER_STAGE_BUFFERS, &bufferStats);
+
+  fflush(stdout);
+  dup2(out, STDOUT_FILENO);
+  close(out);
+
+  char config[MAX_LINE_LENGTH * 2], renderer[MAX_LINE_LENGTH * 2];
+  benchmarkJsonEscape(config, sizeof(config), configfile);
+  benchmarkJsonEscape(renderer, sizeof(renderer), (const char*)glGetString(GL_RENDERER));
+  printf("{\"config\":\"%s\",\"renderer\":\"%s\",\"width\":%d,\"height\":%d,\"frames\":%d,"
+         "\"avg_ms\":%.4f,\"p50_ms\":%.4f,\"p95_ms\":%.4f,\"p99_ms\":%.4f,\"min_ms\":%.4f,\"max_ms\":%.4f,"
+         "\"fps\":%.2f,\"mpix_per_s\":%.2f,\"gpu_draw_avg_ms\":%.4f,\"gpu_draw_p95_ms\":%.4f,"
+         "\"gpu_buffers_avg_ms\":%.4f,\"gpu_buffers_p95_ms\":%.4f}\n",
+         config, renderer, width, height, frames,
+         total / frames, frameTimes[(frames - 1) * 50 / 100], frameTimes[(frames - 1) * 95 / 100],
+         frameTimes[(frames - 1) * 99 / 100], frameTimes[0], frameTimes[frames - 1],
+         frames * 1000.0 / total, (double)width * height * frames / (total * 1000.0),
+         drawStats.avg, drawStats.p95, bufferStats.avg, bufferStats.p95);
+  fflush(stdout);
+
+  free(frameTimes);
+  shaderSessionDispose(&session);
+  gltTerminate();
+
+  glXMakeContextCurrent(dpy, None, None, NULL);
+  glXDestroyContext(dpy, glc);
+  glXDestroyPbuffer(dpy, pbuffer);
+  XCloseDisplay(dpy);
+  return 0;
+}
+
+int main(int argc, char** argv) {
+  if (argc > 1 && strcmp(argv[1], "--bench") == 0) return benchmark(argc, argv);
+
+  // The hot reload worker binds its GL context through the same display connection
+  XInitThreads();
+
+  Display* dpy = XOpenDisplay(NULL);
+  if (!dpy) {
+    fprintf(stderr, "Cannot open display\n");
+    return 1;
+  }
+
+  int    screen = DefaultScreen(dpy);
+  Window root   = RootWindow(dpy, screen);
+
+  GLXFBConfig fbConfig = glxChooseConfig(dpy, screen, GLX_WINDOW_BIT);
+  if (!fbConfig) return 1;
 
   XVisualInfo* vi = glXGetVisualFromFBConfig(dpy, fbConfig);
   if (!vi) {
@@ -1385,18 +5941,7 @@ int main(int argc, char** argv) {
   XLowerWindow(dpy, win);
   XFlush(dpy);
 
-  int majorVersion = 3;
-  int minorVersion = 3;
-
-  int context_attribs[] = {
-    GLX_CONTEXT_MAJOR_VERSION_ARB, majorVersion,
-    GLX_CONTEXT_MINOR_VERSION_ARB, minorVersion,
-    GLX_CONTEXT_PROFILE_MASK_ARB, GLX_CONTEXT_CORE_PROFILE_BIT_ARB,
-    None};
-
-  glXCreateContextAttribsARBProc glXCreateContextAttribsARB = (glXCreateContextAttribsARBProc)glXGetProcAddressARB((const GLubyte*)"glXCreateContextAttribsARB");
-
-  GLXContext glc = glXCreateContextAttribsARB(dpy, fbConfig, 0, True, context_attribs);
+  GLXContext glc = glxCreateContext(dpy, fbConfig, 0);
 
   glXMakeCurrent(dpy, win, glc);
 
@@ -1,11 +1,12 @@
 #include <stdlib.h>
 #include "parser.h"
 #include <unordered_map>
+#include <map>
 #include <string>
 #include <sstream>
 
 struct ParseContext {
-  std::unordered_map<std::string, std::unordered_map<std::string, std::string>> values;
+  std::unordered_map<std::string, std::map<std::string, std::string>> values; // Keys sorted, enumeration is stable
 };
 
 ParseContext* parseContextCreate(const char* str) {
@@ -38,7 +39,7 @@ ParseContext* parseContextCreate(const char* str) {
 
         size_t val_start = value.find_first_not_of(" \t");
         size_t val_end   = value.find_last_not_of(" \t\r\n");
-        value            = value.substr(val_start, val_end - val_start + 1);
+        value            = val_start == std::string::npos ? "" : value.substr(val_start, val_end - val_start + 1);
 
         ctx->values[currentSection][key] = value;
       }
@@ -54,6 +55,18 @@ const char* parseContextGetValue(ParseContext* ctx, const char* section, const c
   return 0;
 }
 
+int parseContextGetKeys(ParseContext* ctx, const char* section, const char** keys, int maxKeys) {
+  auto it = ctx->values.find(std::string(section));
+  if (it == ctx->values.end()) return 0;
+
+  int count = 0;
+  for (auto& entry : it->second) {
+    if (count == maxKeys) break;
+    keys[count++] = entry.first.c_str();
+  }
+  return count;
+}
+
 void parseContextDispose(ParseContext* ctx) {
   delete ctx;
 }
@@ -5,6 +5,7 @@ extern "C" {
 struct ParseContext;
 struct ParseContext* parseContextCreate(const char* str);
 const char*          parseContextGetValue(struct ParseContext* ctx, const char* section, const char* key);
+int                  parseContextGetKeys(struct ParseContext* ctx, const char* section, const char** keys, int maxKeys);
 void                 parseContextDispose(struct ParseContext* ctx);
 
 #ifdef __cplusplus
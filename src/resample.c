@@ -0,0 +1,203 @@
+#include <math.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include "resample.h"
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+//Separable resampler: for every output row the contributing source rows are accumulated into a float row,
+//which is then filtered horizontally. Kernels are precomputed per axis and normalized, edges are clamped.
+
+#define MAX_RESAMPLE_THREADS 16
+#define LANCZOS_RADIUS       3.0f
+
+struct ResampleKernel {
+  int*   start;   // First source index of every output index
+  int*   count;   // Contributing source indices
+  float* weights; // taps weights per output index
+  int    taps;
+};
+
+struct ResampleJob {
+  const unsigned char*   src;
+  unsigned char*         dst;
+  int                    srcWidth;
+  int                    dstWidth;
+  int                    channels;
+  int                    rowBegin;
+  int                    rowEnd;
+  struct ResampleKernel* horizontal;
+  struct ResampleKernel* vertical;
+};
+
+float resampleWeight(enum ResampleFilter filter, float x) {
+  if (filter == RESAMPLE_BOX) return x >= -0.5f && x < 0.5f ? 1.0f : 0.0f;
+
+  if (x == 0.0f) return 1.0f;
+  if (x <= -LANCZOS_RADIUS || x >= LANCZOS_RADIUS) return 0.0f;
+  float px = (float)M_PI * x;
+  return LANCZOS_RADIUS * sinf(px) * sinf(px / LANCZOS_RADIUS) / (px * px);
+}
+
+void resampleKernelBuild(struct ResampleKernel* kernel, int srcSize, int dstSize, enum ResampleFilter filter) {
+  float scale   = (float)srcSize / dstSize;
+  float stretch = scale > 1.0f ? scale : 1.0f; // Minification widens the filter to cover every source texel
+  float support = (filter == RESAMPLE_BOX ? 0.5f : LANCZOS_RADIUS) * stretch;
+
+  kernel->taps    = (int)ceilf(support) * 2 + 2;
+  kernel->start   = malloc(dstSize * sizeof(int));
+  kernel->count   = malloc(dstSize * sizeof(int));
+  kernel->weights = calloc((size_t)dstSize * kernel->taps, sizeof(float));
+
+  for (int i = 0; i < dstSize; i++) {
+    float  center  = (i + 0.5f) * scale;
+    int    first   = (int)floorf(center - support);
+    int    last    = (int)ceilf(center + support);
+    float* weights = kernel->weights + (size_t)i * kernel->taps;
+    float  total   = 0.0f;
+    if (first < 0) first = 0;
+    if (last > srcSize - 1) last = srcSize - 1;
+    if (last - first + 1 > kernel->taps) last = first + kernel->taps - 1;
+
+    for (int j = first; j <= last; j++) {
+      weights[j - first] = resampleWeight(filter, (j + 0.5f - center) / stretch);
+      total += weights[j - first];
+    }
+    for (int j = first; j <= last && total != 0.0f; j++) weights[j - first] /= total;
+
+    kernel->start[i] = first;
+    kernel->count[i] = last - first + 1;
+  }
+}
+
+void resampleKernelDispose(struct ResampleKernel* kernel) {
+  free(kernel->start);
+  free(kernel->count);
+  free(kernel->weights);
+}
+
+//row += weight * src for length bytes
+void resampleAccumulate(float* row, const unsigned char* src, float weight, int length) {
+  int i = 0;
+#ifdef __SSE2__
+  __m128  w    = _mm_set1_ps(weight);
+  __m128i zero = _mm_setzero_si128();
+  for (; i + 16 <= length; i += 16) {
+    __m128i bytes = _mm_loadu_si128((const __m128i*)(src + i));
+    __m128i lo    = _mm_unpacklo_epi8(bytes, zero);
+    __m128i hi    = _mm_unpackhi_epi8(bytes, zero);
+    __m128i v[4]  = {_mm_unpacklo_epi16(lo, zero), _mm_unpackhi_epi16(lo, zero), _mm_unpacklo_epi16(hi, zero), _mm_unpackhi_epi16(hi, zero)};
+    for (int k = 0; k < 4; k++) {
+      __m128 acc = _mm_loadu_ps(row + i + 4 * k);
+      _mm_storeu_ps(row + i + 4 * k, _mm_add_ps(acc, _mm_mul_ps(_mm_cvtepi32_ps(v[k]), w)));
+    }
+  }
+#endif
+  for (; i < length; i++) row[i] += weight * src[i];
+}
+
+unsigned char resampleClamp(float value) {
+  return value <= 0.0f ? 0 : value >= 255.0f ? 255 : (unsigned char)(value + 0.5f);
+}
+
+void resampleRow(const float* row, unsigned char* dst, int dstWidth, int channels, struct ResampleKernel* horizontal) {
+  for (int x = 0; x < dstWidth; x++) {
+    const float* weights = horizontal->weights + (size_t)x * horizontal->taps;
+    const float* source  = row + (size_t)horizontal->start[x] * channels;
+    int          count   = horizontal->count[x];
+
+#ifdef __SSE2__
+    if (channels == 4) {
+      __m128 acc = _mm_setzero_ps();
+      for (int k = 0; k < count; k++) acc = _mm_add_ps(acc, _mm_mul_ps(_mm_loadu_ps(source + 4 * k), _mm_set1_ps(weights[k])));
+      __m128i pixel = _mm_cvtps_epi32(acc);
+      pixel         = _mm_packs_epi32(pixel, pixel);
+      pixel         = _mm_packus_epi16(pixel, pixel);
+      uint32_t packed = (uint32_t)_mm_cvtsi128_si32(pixel);
+      memcpy(dst + (size_t)x * 4, &packed, 4);
+      continue;
+    }
+#endif
+
+    float acc[4] = {0};
+    for (int k = 0; k < count; k++)
+      for (int c = 0; c < channels; c++) acc[c] += weights[k] * source[k * channels + c];
+    for (int c = 0; c < channels; c++) dst[(size_t)x * channels + c] = resampleClamp(acc[c]);
+  }
+}
+
+void* resampleWorker(void* arg) {
+  struct ResampleJob* job    = arg;
+  int                 length = job->srcWidth * job->channels;
+  float*              row    = malloc(length * sizeof(float));
+
+  for (int y = job->rowBegin; y < job->rowEnd; y++) {
+    const float* weights = job->vertical->weights + (size_t)y * job->vertical->taps;
+    memset(row, 0, length * sizeof(float));
+    for (int k = 0; k < job->vertical->count[y]; k++)
+      resampleAccumulate(row, job->src + (size_t)(job->vertical->start[y] + k) * length, weights[k], length);
+    resampleRow(row, job->dst + (size_t)y * job->dstWidth * job->channels, job->dstWidth, job->channels, job->horizontal);
+  }
+
+  free(row);
+  return NULL;
+}
+
+void resampleImage(const unsigned char* src, int srcWidth, int srcHeight, int channels, unsigned char* dst, int dstWidth, int dstHeight,
+                   enum ResampleFilter filter, int threadCount) {
+  struct ResampleKernel horizontal, vertical;
+  resampleKernelBuild(&horizontal, srcWidth, dstWidth, filter);
+  resampleKernelBuild(&vertical, srcHeight, dstHeight, filter);
+
+  if (threadCount > MAX_RESAMPLE_THREADS) threadCount = MAX_RESAMPLE_THREADS;
+  if (threadCount > dstHeight) threadCount = dstHeight;
+  if (threadCount < 1) threadCount = 1;
+
+  pthread_t          threads[MAX_RESAMPLE_THREADS];
+  struct ResampleJob jobs[MAX_RESAMPLE_THREADS];
+  for (int i = 0; i < threadCount; i++) {
+    jobs[i] = (struct ResampleJob){src, dst, srcWidth, dstWidth, channels, dstHeight * i / threadCount, dstHeight * (i + 1) / threadCount, &horizontal, &vertical};
+    if (i > 0) pthread_create(&threads[i], NULL, resampleWorker, &jobs[i]);
+  }
+  resampleWorker(&jobs[0]);
+  for (int i = 1; i < threadCount; i++) pthread_join(threads[i], NULL);
+
+  resampleKernelDispose(&horizontal);
+  resampleKernelDispose(&vertical);
+}
+
+void resampleHalf(const unsigned char* src, int width, int height, int channels, unsigned char* dst) {
+  int halfWidth  = width > 1 ? width / 2 : 1;
+  int halfHeight = height > 1 ? height / 2 : 1;
+
+  for (int y = 0; y < halfHeight; y++) {
+    const unsigned char* row0 = src + (size_t)(2 * y) * width * channels;
+    const unsigned char* row1 = src + (size_t)(2 * y + 1 < height ? 2 * y + 1 : 2 * y) * width * channels;
+    unsigned char*       out  = dst + (size_t)y * halfWidth * channels;
+    int                  x    = 0;
+
+#ifdef __SSE2__
+    // Four RGBA source pixels of both rows give two output pixels
+    __m128i zero = _mm_setzero_si128();
+    __m128i two  = _mm_set1_epi16(2);
+    for (; channels == 4 && 2 * x + 3 < width; x += 2) {
+      __m128i a   = _mm_loadu_si128((const __m128i*)(row0 + 8 * x));
+      __m128i b   = _mm_loadu_si128((const __m128i*)(row1 + 8 * x));
+      __m128i lo  = _mm_add_epi16(_mm_unpacklo_epi8(a, zero), _mm_unpacklo_epi8(b, zero)); // Pixels 0 and 1
+      __m128i hi  = _mm_add_epi16(_mm_unpackhi_epi8(a, zero), _mm_unpackhi_epi8(b, zero)); // Pixels 2 and 3
+      __m128i sum = _mm_add_epi16(_mm_unpacklo_epi64(lo, hi), _mm_unpackhi_epi64(lo, hi));
+      sum         = _mm_srli_epi16(_mm_add_epi16(sum, two), 2);
+      _mm_storel_epi64((__m128i*)(out + 4 * x), _mm_packus_epi16(sum, sum));
+    }
+#endif
+
+    for (; x < halfWidth; x++) {
+      int x0 = 2 * x * channels;
+      int x1 = (2 * x + 1 < width ? 2 * x + 1 : 2 * x) * channels;
+      for (int c = 0; c < channels; c++) out[x * channels + c] = (row0[x0 + c] + row0[x1 + c] + row1[x0 + c] + row1[x1 + c] + 2) / 4;
+    }
+  }
+}
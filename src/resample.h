@@ -0,0 +1,21 @@
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+enum ResampleFilter {
+  RESAMPLE_NONE = 0,
+  RESAMPLE_BOX,
+  RESAMPLE_LANCZOS
+};
+
+//Resizes an 8 bit image with 1-4 interleaved channels, splitting the output rows across threadCount threads
+void resampleImage(const unsigned char* src, int srcWidth, int srcHeight, int channels, unsigned char* dst, int dstWidth, int dstHeight,
+                   enum ResampleFilter filter, int threadCount);
+
+//Next mip level: 2x2 box filter to half size, odd edges reuse the last row or column
+void resampleHalf(const unsigned char* src, int width, int height, int channels, unsigned char* dst);
+
+#ifdef __cplusplus
+}
+#endif
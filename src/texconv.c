@@ -0,0 +1,307 @@
+#include <math.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "stb_image.h"
+
+//Converts images into BC1 (opaque) or BC3 (with alpha) DDS files with a full mip chain that shaderpaper uploads
+//without decoding. Rows are stored bottom-up, the orientation shaderpaper gives decoded images.
+
+#define MAX_PATH_LENGTH 512
+
+enum BlockFormat {
+  FORMAT_AUTO = 0,
+  FORMAT_BC1,
+  FORMAT_BC3
+};
+
+struct Image {
+  unsigned char* pixels; // RGBA8
+  int            width;
+  int            height;
+};
+
+//=====================================================[ENCODER]=======================================================
+
+uint16_t packColor(const float* color) {
+  int r = (int)(color[0] * 31.0f / 255.0f + 0.5f);
+  int g = (int)(color[1] * 63.0f / 255.0f + 0.5f);
+  int b = (int)(color[2] * 31.0f / 255.0f + 0.5f);
+  r     = r < 0 ? 0 : r > 31 ? 31 : r;
+  g     = g < 0 ? 0 : g > 63 ? 63 : g;
+  b     = b < 0 ? 0 : b > 31 ? 31 : b;
+  return (uint16_t)(r << 11 | g << 5 | b);
+}
+
+void unpackColor(uint16_t packed, float* color) {
+  color[0] = ((packed >> 11) & 31) * 255.0f / 31.0f;
+  color[1] = ((packed >> 5) & 63) * 255.0f / 63.0f;
+  color[2] = (packed & 31) * 255.0f / 31.0f;
+}
+
+//Endpoints are the extremes of the block along its principal axis, inset a little to reduce the quantization error
+void colorEndpoints(const unsigned char block[16][4], float* lo, float* hi) {
+  float mean[3] = {0};
+  for (int i = 0; i < 16; i++)
+    for (int c = 0; c < 3; c++) mean[c] += block[i][c] / 16.0f;
+
+  float cov[6] = {0};
+  for (int i = 0; i < 16; i++) {
+    float d[3] = {block[i][0] - mean[0], block[i][1] - mean[1], block[i][2] - mean[2]};
+    cov[0] += d[0] * d[0];
+    cov[1] += d[0] * d[1];
+    cov[2] += d[0] * d[2];
+    cov[3] += d[1] * d[1];
+    cov[4] += d[1] * d[2];
+    cov[5] += d[2] * d[2];
+  }
+
+  float axis[3] = {1.0f, 1.0f, 1.0f};
+  for (int iteration = 0; iteration < 8; iteration++) {
+    float next[3] = {cov[0] * axis[0] + cov[1] * axis[1] + cov[2] * axis[2],
+                     cov[1] * axis[0] + cov[3] * axis[1] + cov[4] * axis[2],
+                     cov[2] * axis[0] + cov[4] * axis[1] + cov[5] * axis[2]};
+    float length  = sqrtf(next[0] * next[0] + next[1] * next[1] + next[2] * next[2]);
+    if (length < 1e-6f) break;
+    for (int c = 0; c < 3; c++) axis[c] = next[c] / length;
+  }
+
+  float minProjection = 1e9f, maxProjection = -1e9f;
+  for (int i = 0; i < 16; i++) {
+    float projection = (block[i][0] - mean[0]) * axis[0] + (block[i][1] - mean[1]) * axis[1] + (block[i][2] - mean[2]) * axis[2];
+    if (projection < minProjection) minProjection = projection;
+    if (projection > maxProjection) maxProjection = projection;
+  }
+
+  float inset = (maxProjection - minProjection) / 32.0f;
+  for (int c = 0; c < 3; c++) {
+    lo[c] = mean[c] + axis[c] * (minProjection + inset);
+    hi[c] = mean[c] + axis[c] * (maxProjection - inset);
+  }
+}
+
+void encodeColorBlock(const unsigned char block[16][4], unsigned char* out) {
+  float lo[3], hi[3];
+  colorEndpoints(block, lo, hi);
+
+  uint16_t c0 = packColor(hi);
+  uint16_t c1 = packColor(lo);
+  if (c0 < c1) {
+    uint16_t swap = c0;
+    c0            = c1;
+    c1            = swap;
+  }
+
+  // Four color mode needs c0 > c1, equal endpoints make every index 0
+  float palette[4][3];
+  unpackColor(c0, palette[0]);
+  unpackColor(c1, palette[1]);
+  for (int c = 0; c < 3; c++) {
+    palette[2][c] = (2.0f * palette[0][c] + palette[1][c]) / 3.0f;
+    palette[3][c] = (palette[0][c] + 2.0f * palette[1][c]) / 3.0f;
+  }
+
+  uint32_t indices = 0;
+  for (int i = 0; i < 16 && c0 != c1; i++) {
+    int   best         = 0;
+    float bestDistance = 1e30f;
+    for (int p = 0; p < 4; p++) {
+      float dr       = block[i][0] - palette[p][0];
+      float dg       = block[i][1] - palette[p][1];
+      float db       = block[i][2] - palette[p][2];
+      float distance = dr * dr + dg * dg + db * db;
+      if (distance < bestDistance) {
+        bestDistance = distance;
+        best         = p;
+      }
+    }
+    indices |= (uint32_t)best << (2 * i);
+  }
+
+  out[0] = c0 & 0xFF;
+  out[1] = c0 >> 8;
+  out[2] = c1 & 0xFF;
+  out[3] = c1 >> 8;
+  for (int i = 0; i < 4; i++) out[4 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+//Eight alpha values interpolated between the block minimum and maximum
+void encodeAlphaBlock(const unsigned char block[16][4], unsigned char* out) {
+  int a0 = 0, a1 = 255;
+  for (int i = 0; i < 16; i++) {
+    if (block[i][3] > a0) a0 = block[i][3];
+    if (block[i][3] < a1) a1 = block[i][3];
+  }
+
+  uint64_t indices = 0;
+  for (int i = 0; i < 16 && a0 != a1; i++) {
+    // Position along a0..a1 mapped to the index order 0 (a0), 2..7, 1 (a1)
+    int step  = (int)((float)(a0 - block[i][3]) * 7.0f / (a0 - a1) + 0.5f);
+    int index = step == 0 ? 0 : step == 7 ? 1 : step + 1;
+    indices |= (uint64_t)index << (3 * i);
+  }
+
+  out[0] = a0;
+  out[1] = a1;
+  for (int i = 0; i < 6; i++) out[2 + i] = (indices >> (8 * i)) & 0xFF;
+}
+
+//Encodes one mip level, blocks past the right or bottom edge repeat the border pixels
+unsigned char* encodeImage(const struct Image* image, enum BlockFormat format, size_t* size) {
+  int            blocksX    = (image->width + 3) / 4;
+  int            blocksY    = (image->height + 3) / 4;
+  int            blockBytes = format == FORMAT_BC1 ? 8 : 16;
+  unsigned char* out        = malloc((size_t)blocksX * blocksY * blockBytes);
+  *size                     = (size_t)blocksX * blocksY * blockBytes;
+
+  for (int by = 0; by < blocksY; by++) {
+    for (int bx = 0; bx < blocksX; bx++) {
+      unsigned char block[16][4];
+      for (int i = 0; i < 16; i++) {
+        int x = bx * 4 + i % 4;
+        int y = by * 4 + i / 4;
+        x     = x < image->width ? x : image->width - 1;
+        y     = y < image->height ? y : image->height - 1;
+        memcpy(block[i], image->pixels + ((size_t)y * image->width + x) * 4, 4);
+      }
+
+      unsigned char* dst = out + ((size_t)by * blocksX + bx) * blockBytes;
+      if (format == FORMAT_BC3) {
+        encodeAlphaBlock(block, dst);
+        dst += 8;
+      }
+      encodeColorBlock(block, dst);
+    }
+  }
+  return out;
+}
+
+//Box filters the image to half its size, odd edges reuse the last row or column
+struct Image downsample(const struct Image* image) {
+  struct Image half;
+  half.width  = image->width > 1 ? image->width / 2 : 1;
+  half.height = image->height > 1 ? image->height / 2 : 1;
+  half.pixels = malloc((size_t)half.width * half.height * 4);
+
+  for (int y = 0; y < half.height; y++) {
+    for (int x = 0; x < half.width; x++) {
+      int x0 = x * 2, x1 = x * 2 + 1 < image->width ? x * 2 + 1 : x * 2;
+      int y0 = y * 2, y1 = y * 2 + 1 < image->height ? y * 2 + 1 : y * 2;
+      for (int c = 0; c < 4; c++) {
+        int sum = image->pixels[((size_t)y0 * image->width + x0) * 4 + c] + image->pixels[((size_t)y0 * image->width + x1) * 4 + c] +
+                  image->pixels[((size_t)y1 * image->width + x0) * 4 + c] + image->pixels[((size_t)y1 * image->width + x1) * 4 + c];
+        half.pixels[((size_t)y * half.width + x) * 4 + c] = (sum + 2) / 4;
+      }
+    }
+  }
+  return half;
+}
+
+//=====================================================[DDS]===========================================================
+
+void writeU32(FILE* file, uint32_t value) {
+  unsigned char bytes[4] = {value & 0xFF, (value >> 8) & 0xFF, (value >> 16) & 0xFF, value >> 24};
+  fwrite(bytes, 1, 4, file);
+}
+
+void ddsWriteHeader(FILE* file, int width, int height, int levelCount, size_t baseSize, enum BlockFormat format) {
+  fwrite("DDS ", 1, 4, file);
+  writeU32(file, 124);
+  writeU32(file, 0x1 | 0x2 | 0x4 | 0x1000 | 0x20000 | 0x80000); // CAPS, HEIGHT, WIDTH, PIXELFORMAT, MIPMAPCOUNT, LINEARSIZE
+  writeU32(file, height);
+  writeU32(file, width);
+  writeU32(file, baseSize);
+  writeU32(file, 0);
+  writeU32(file, levelCount);
+  for (int i = 0; i < 11; i++) writeU32(file, 0);
+
+  writeU32(file, 32);
+  writeU32(file, 0x4); // DDPF_FOURCC
+  fwrite(format == FORMAT_BC1 ? "DXT1" : "DXT5", 1, 4, file);
+  for (int i = 0; i < 5; i++) writeU32(file, 0);
+
+  writeU32(file, 0x1000 | (levelCount > 1 ? 0x8 | 0x400000 : 0)); // TEXTURE, COMPLEX, MIPMAP
+  for (int i = 0; i < 4; i++) writeU32(file, 0);
+}
+
+int convert(const char* input, const char* output, enum BlockFormat format, int mips) {
+  struct Image image;
+  int          channels;
+  stbi_set_flip_vertically_on_load(1);
+  image.pixels = stbi_load(input, &image.width, &image.height, &channels, 4);
+  if (!image.pixels) {
+    fprintf(stderr, "[ERR] %s: %s\n", input, stbi_failure_reason());
+    return 1;
+  }
+  if (format == FORMAT_AUTO) format = channels == 2 || channels == 4 ? FORMAT_BC3 : FORMAT_BC1;
+
+  int levelCount = 1;
+  for (int w = image.width, h = image.height; mips && (w > 1 || h > 1); levelCount++) {
+    w = w > 1 ? w / 2 : 1;
+    h = h > 1 ? h / 2 : 1;
+  }
+
+  FILE* file = fopen(output, "wb");
+  if (!file) {
+    fprintf(stderr, "[ERR] Cannot write %s\n", output);
+    stbi_image_free(image.pixels);
+    return 1;
+  }
+
+  size_t uncompressed = 0, compressed = 0;
+  int    width = image.width, height = image.height;
+  for (int level = 0; level < levelCount; level++) {
+    size_t         size;
+    unsigned char* blocks = encodeImage(&image, format, &size);
+    if (level == 0) ddsWriteHeader(file, width, height, levelCount, size, format);
+    fwrite(blocks, 1, size, file);
+    free(blocks);
+
+    uncompressed += (size_t)image.width * image.height * channels;
+    compressed += size;
+    if (level + 1 < levelCount) {
+      struct Image half = downsample(&image);
+      free(image.pixels);
+      image = half;
+    }
+  }
+  free(image.pixels);
+  fclose(file);
+
+  fprintf(stderr, "[OK] %s -> %s %dx%d %s, %d levels, %.2f MB -> %.2f MB\n", input, output, width, height,
+          format == FORMAT_BC1 ? "BC1" : "BC3", levelCount, uncompressed / 1e6, compressed / 1e6);
+  return 0;
+}
+
+void printUsage() {
+  fprintf(stderr, "Usage: shaderpaper-texconv [--bc1|--bc3] [--no-mips] <image>... \n");
+  fprintf(stderr, "       Writes <image> with a .dds extension next to each input, BC3 for images with alpha, BC1 otherwise\n");
+}
+
+int main(int argc, char** argv) {
+  enum BlockFormat format = FORMAT_AUTO;
+  int              mips   = 1;
+  int              failed = 0;
+  int              inputs = 0;
+
+  for (int i = 1; i < argc; i++) {
+    if (strcmp(argv[i], "--bc1") == 0) format = FORMAT_BC1;
+    else if (strcmp(argv[i], "--bc3") == 0) format = FORMAT_BC3;
+    else if (strcmp(argv[i], "--no-mips") == 0) mips = 0;
+    else if (argv[i][0] == '-') {
+      printUsage();
+      return 1;
+    } else {
+      char        output[MAX_PATH_LENGTH];
+      const char* extension = strrchr(argv[i], '.');
+      int         length    = extension && !strchr(extension, '/') ? (int)(extension - argv[i]) : (int)strlen(argv[i]);
+      snprintf(output, sizeof(output), "%.*s.dds", length, argv[i]);
+      failed |= convert(argv[i], output, format, mips);
+      inputs++;
+    }
+  }
+
+  if (!inputs) printUsage();
+  return failed || !inputs;
+}